@@ -0,0 +1,297 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# i10-bench.sh	i10 vs nvme-tcp benchmark harness.
+#
+# Target side:	i10-bench.sh target-up [i10|tcp]
+#		i10-bench.sh target-down
+# Host side:	i10-bench.sh connect [i10|tcp]
+#		i10-bench.sh run [i10|tcp]
+#		i10-bench.sh disconnect
+# From the host, driving the target over ssh (TARGET_SSH must be set):
+#		i10-bench.sh all	(both transports, one after the other)
+#
+# Everything else comes from the environment:
+#   TRADDR	target address (required)
+#   TRSVCID	port (4420)		NQN	subsystem (i10-bench)
+#   NS_PATH	namespace backend: ram:<size>, null:<size> or a block
+#		device (ram:4G); jobs use 1G each, at 1G apart
+#   PORT_PARAMS	extra port attributes, e.g. "busy_poll=1 inline_data_size=65536"
+#   BS		block sizes ("4k 16k 128k")
+#   PATTERNS	"rand seq"		MIXES	"read write rw70"
+#   QDS		"1 4 16 32 64 128"	JOBS	"1 4"
+#   RUNTIME	seconds per point (30)	RAMP	warm-up seconds (5)
+#   OUT		result directory (results/<date>)
+#   TARGET_SSH	ssh destination of the target, to run its half and to
+#		capture its i10 stats and CPU time next to each point
+#   TARGET_SRC	this tree on the target, for modules not installed there
+#   SRC_DIR	this tree, where modules are looked for (the script's)
+#
+# Every fio point leaves <name>.json (fio), <name>.cpu (host, and target
+# if reachable, busy jiffies during the run) and, for i10, the per-queue
+# debugfs stats before and after it.  summarize.py turns a result
+# directory into one CSV line per point.
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+SRC_DIR=${SRC_DIR:-$(dirname "$BENCH_DIR")}
+CFG=/sys/kernel/config/nvmet
+DBG=/sys/kernel/debug
+
+TRSVCID=${TRSVCID:-4420}
+NQN=${NQN:-i10-bench}
+NS_PATH=${NS_PATH:-ram:4G}
+PORT_ID=${PORT_ID:-1}
+BS=${BS:-"4k 16k 128k"}
+PATTERNS=${PATTERNS:-"rand seq"}
+MIXES=${MIXES:-"read write rw70"}
+QDS=${QDS:-"1 4 16 32 64 128"}
+JOBS=${JOBS:-"1 4"}
+RUNTIME=${RUNTIME:-30}
+RAMP=${RAMP:-5}
+OUT=${OUT:-results/$(date +%Y%m%d-%H%M%S)}
+
+die()
+{
+	echo "i10-bench: $*" >&2
+	exit 1
+}
+
+load_module()
+{
+	modprobe "$1" 2>/dev/null && return
+	insmod "$2/$1.ko" 2>/dev/null || lsmod | grep -q "^${1//-/_} " ||
+		die "cannot load $1"
+}
+
+target_up()
+{
+	local trtype=${1:-i10} sub=$CFG/subsystems/$NQN port=$CFG/ports/$PORT_ID
+	local kv
+
+	[ -n "$TRADDR" ] || die "TRADDR is not set"
+	load_module nvmet "$SRC_DIR/target"
+	case $trtype in
+	i10)	load_module i10-target "$SRC_DIR/target" ;;
+	tcp)	load_module nvmet-tcp "$SRC_DIR/target" ;;
+	*)	die "unknown transport $trtype" ;;
+	esac
+
+	mkdir -p "$sub/namespaces/1"
+	echo 1 > "$sub/attr_allow_any_host"
+	echo "$NS_PATH" > "$sub/namespaces/1/device_path"
+	echo 1 > "$sub/namespaces/1/enable"
+
+	mkdir -p "$port"
+	echo ipv4 > "$port/addr_adrfam"
+	echo "$trtype" > "$port/addr_trtype"
+	echo "$TRADDR" > "$port/addr_traddr"
+	echo "$TRSVCID" > "$port/addr_trsvcid"
+	for kv in $PORT_PARAMS; do
+		echo "${kv#*=}" > "$port/param_${kv%%=*}"
+	done
+	ln -s "$sub" "$port/subsystems/$NQN"
+}
+
+target_down()
+{
+	local sub=$CFG/subsystems/$NQN port=$CFG/ports/$PORT_ID
+
+	rm -f "$port/subsystems/$NQN"
+	[ -d "$port" ] && rmdir "$port"
+	if [ -d "$sub" ]; then
+		echo 0 > "$sub/namespaces/1/enable"
+		rmdir "$sub/namespaces/1"
+		rmdir "$sub"
+	fi
+	return 0
+}
+
+# Controller of our subsystem on transport $1, e.g. nvme3
+host_ctrl()
+{
+	local c
+
+	for c in /sys/class/nvme/nvme*; do
+		[ "$(cat "$c/subsysnqn" 2>/dev/null)" = "$NQN" ] || continue
+		[ "$(cat "$c/transport")" = "$1" ] || continue
+		basename "$c"
+		return
+	done
+}
+
+# Block device of namespace 1 behind controller $1; multipath nodes
+# (nvmeXcYnZ) map to their nvmeXnZ head
+host_dev()
+{
+	local ns
+
+	for ns in /sys/class/nvme/"$1"/nvme*n1; do
+		[ -e "$ns" ] || continue
+		echo "/dev/$(basename "$ns" | sed 's/c[0-9]\+n/n/')"
+		return
+	done
+}
+
+host_connect()
+{
+	local trtype=${1:-i10} i
+
+	[ -n "$TRADDR" ] || die "TRADDR is not set"
+	case $trtype in
+	i10)	load_module i10-host "$SRC_DIR/host" ;;
+	tcp)	load_module nvme-tcp "$SRC_DIR/host" ;;
+	*)	die "unknown transport $trtype" ;;
+	esac
+	nvme connect -t "$trtype" -a "$TRADDR" -s "$TRSVCID" -n "$NQN"
+	for i in $(seq 50); do
+		[ -n "$(host_dev "$(host_ctrl "$trtype")")" ] && return
+		sleep 0.1
+	done
+	die "no namespace showed up for $NQN over $trtype"
+}
+
+host_disconnect()
+{
+	nvme disconnect -n "$NQN" > /dev/null || true
+}
+
+cpu_busy()
+{
+	awk '/^cpu / { print $2 + $3 + $4 + $7 + $8 }' /proc/stat
+}
+
+target_sh()
+{
+	[ -n "$TARGET_SSH" ] || return 0
+	ssh "$TARGET_SSH" "$@"
+}
+
+# Per-queue i10 stats of both ends into $1
+save_stats()
+{
+	local f
+
+	for f in "$DBG"/i10_host/"$CTRL"/queue*/stats; do
+		[ -e "$f" ] || continue
+		echo "== host ${f#$DBG/i10_host/}"
+		cat "$f"
+	done > "$1"
+	target_sh 'for f in /sys/kernel/debug/i10_target/queue*/stats; do
+			[ -e "$f" ] || continue
+			echo "== target ${f#/sys/kernel/debug/i10_target/}"
+			cat "$f"
+		done' >> "$1"
+}
+
+fio_rw()
+{
+	local pattern=$1 mix=$2 rw
+
+	case $mix in
+	read)	rw=read ;;
+	write)	rw=write ;;
+	rw70)	rw=rw ;;
+	*)	die "unknown mix $mix" ;;
+	esac
+	if [ "$pattern" = rand ]; then
+		[ "$rw" = rw ] && rw=randrw || rw=rand$rw
+	fi
+	echo "$rw"
+}
+
+run_point()
+{
+	local trtype=$1 bs=$2 pattern=$3 mix=$4 qd=$5 jobs=$6
+	local name=$OUT/$trtype-$bs-$pattern-$mix-qd$qd-j$jobs
+	local hb ha tb ta wb
+
+	echo "i10-bench: ${name##*/}"
+	[ "$trtype" = i10 ] && save_stats "$name.stats.before"
+	wb=$(date +%s%N)
+	hb=$(cpu_busy)
+	tb=$(target_sh "awk '/^cpu / { print \$2 + \$3 + \$4 + \$7 + \$8 }' /proc/stat")
+
+	fio --name=bench --filename="$DEV" --direct=1 --ioengine=libaio \
+		--rw="$(fio_rw "$pattern" "$mix")" --rwmixread=70 \
+		--bs="$bs" --iodepth="$qd" --numjobs="$jobs" \
+		--group_reporting --time_based --runtime="$RUNTIME" \
+		--ramp_time="$RAMP" --size=1G --offset_increment=1G \
+		--output-format=json --output="$name.json"
+
+	ha=$(cpu_busy)
+	ta=$(target_sh "awk '/^cpu / { print \$2 + \$3 + \$4 + \$7 + \$8 }' /proc/stat")
+	{
+		echo "hz $(getconf CLK_TCK)"
+		echo "wall_ns $(($(date +%s%N) - wb))"
+		echo "host $((ha - hb))"
+		if [ -n "$tb" ]; then
+			echo "target $((ta - tb))"
+		fi
+	} > "$name.cpu"
+	[ "$trtype" = i10 ] && save_stats "$name.stats.after"
+	return 0
+}
+
+run_matrix()
+{
+	local trtype=${1:-i10} bs pattern mix qd jobs
+
+	CTRL=$(host_ctrl "$trtype")
+	DEV=$(host_dev "$CTRL")
+	[ -b "$DEV" ] || die "not connected over $trtype, run connect first"
+
+	mkdir -p "$OUT"
+	{
+		echo "date $(date -R)"
+		echo "host $(uname -nr)"
+		echo "target $(target_sh uname -nr)"
+		echo "transport $trtype device $DEV ns $NS_PATH"
+		echo "port_params $PORT_PARAMS"
+		[ -d /sys/module/i10_host/parameters ] &&
+			grep . /sys/module/i10_host/parameters/*
+		target_sh 'grep . /sys/module/i10_target/parameters/* 2>/dev/null'
+	} > "$OUT/$trtype.env"
+
+	for bs in $BS; do
+	for pattern in $PATTERNS; do
+	for mix in $MIXES; do
+	for qd in $QDS; do
+	for jobs in $JOBS; do
+		run_point "$trtype" "$bs" "$pattern" "$mix" "$qd" "$jobs"
+	done
+	done
+	done
+	done
+	done
+}
+
+run_all()
+{
+	local trtype env
+
+	[ -n "$TARGET_SSH" ] || die "TARGET_SSH is not set"
+	env="TRADDR='$TRADDR' TRSVCID='$TRSVCID' NQN='$NQN' NS_PATH='$NS_PATH'"
+	env="$env PORT_ID='$PORT_ID' PORT_PARAMS='$PORT_PARAMS'"
+	[ -n "$TARGET_SRC" ] && env="$env SRC_DIR='$TARGET_SRC'"
+	for trtype in i10 tcp; do
+		target_sh "$env bash -s target-up $trtype" < "$0"
+		host_connect "$trtype"
+		run_matrix "$trtype"
+		host_disconnect
+		target_sh "$env bash -s target-down" < "$0"
+	done
+	python3 "$BENCH_DIR/summarize.py" "$OUT" > "$OUT/summary.csv"
+	echo "i10-bench: results in $OUT/summary.csv"
+}
+
+case $1 in
+target-up)	target_up "$2" ;;
+target-down)	target_down ;;
+connect)	host_connect "$2" ;;
+disconnect)	host_disconnect ;;
+run)		run_matrix "$2" ;;
+all)		run_all ;;
+*)		sed -n '3,33s/^# \?//p' "$0"; exit 1 ;;
+esac
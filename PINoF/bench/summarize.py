@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0
+#
+# summarize.py	One CSV line per point of an i10-bench.sh result directory.
+#
+# USAGE: summarize.py <result dir> > summary.csv
+#
+# Latencies are fio completion latencies in microseconds, per direction.
+# CPU per IO is the busy time of the whole machine (user, system, irq and
+# softirq, so transport work done outside fio counts) during the point,
+# in microseconds, divided by the IOs fio saw over the same wall time.
+
+import glob
+import json
+import os
+import re
+import sys
+
+NAME = re.compile(r'^(\w+)-(\w+)-(\w+)-(\w+)-qd(\d+)-j(\d+)\.json$')
+PCTS = ('50.000000', '99.000000', '99.900000')
+
+
+def lat_us(d):
+    pct = d.get('clat_ns', {}).get('percentile', {})
+    return ['%.1f' % (pct[p] / 1000.0) if p in pct else '' for p in PCTS]
+
+
+def cpu_per_io(cpu, side, iops):
+    if side not in cpu or not iops or not cpu.get('wall_ns'):
+        return ''
+    busy_us = cpu[side] * 1e6 / cpu['hz']
+    ios = iops * cpu['wall_ns'] / 1e9
+    return '%.2f' % (busy_us / ios)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('usage: summarize.py <result dir>')
+
+    print('transport,bs,pattern,mix,qd,jobs,iops,'
+          'read_p50_us,read_p99_us,read_p99.9_us,'
+          'write_p50_us,write_p99_us,write_p99.9_us,'
+          'host_cpu_us_per_io,target_cpu_us_per_io')
+    for path in sorted(glob.glob(os.path.join(sys.argv[1], '*.json'))):
+        m = NAME.match(os.path.basename(path))
+        if not m:
+            continue
+        with open(path) as f:
+            job = json.load(f)['jobs'][0]
+        iops = job['read']['iops'] + job['write']['iops']
+
+        cpu = {}
+        try:
+            with open(path[:-len('.json')] + '.cpu') as f:
+                for line in f:
+                    k, v = line.split()
+                    cpu[k] = int(v)
+        except OSError:
+            pass
+
+        row = list(m.groups()) + ['%.0f' % iops]
+        row += lat_us(job['read']) + lat_us(job['write'])
+        row += [cpu_per_io(cpu, 'host', iops),
+                cpu_per_io(cpu, 'target', iops)]
+        print(','.join(row))
+
+
+if __name__ == '__main__':
+    main()
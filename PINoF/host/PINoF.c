@@ -20,20 +20,40 @@
 #include <linux/nvme-tcp.h>
 #include <net/sock.h>
 #include <net/tcp.h>
+#include <net/busy_poll.h>
 #include <linux/blk-mq.h>
-#include <crypto/hash.h>
+#include <linux/llist.h>
+#include <linux/jump_label.h>
+#include <linux/crc32.h>
+#include <linux/crc32c.h>
+#include <linux/highmem.h>
 #include <linux/bio.h>
 #include <linux/hrtimer.h>
 #include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
 
 #include "nvme.h"
 #include "fabrics.h"
 
+#define CREATE_TRACE_POINTS
+#include "i10_trace.h"
+
 #define I10_CARAVAN_CAPACITY		98304
-#define I10_CARAVAN2_CAPACITY		1024									//xiugai
-#define I10_AGGREGATION_SIZE		16										
-#define I10_AGGREGATION_SIZE2		12										//xiugai
+#define I10_CARAVAN2_CAPACITY		1024
+#define I10_AGGREGATION_SIZE		16
+#define I10_AGGREGATION_SIZE2		12
+#define I10_AGGREGATION_MAX		64
 #define I10_MIN_DOORBELL_TIMEOUT	25
+#define I10_H2C_DATA_CHUNK		32768
+#define I10_BULK_READ_SIZE		65536
+#define I10_HOST_COMP_BATCH		32
+#define I10_CARAVAN_STAGE_MAX		SZ_64K
+
+/* Adaptive doorbell: EWMA weight (1/8) and idle gap clamp */
+#define I10_DOORBELL_EWMA_SHIFT		3
+#define I10_DOORBELL_MAX_GAP_NS		(10 * NSEC_PER_MSEC)
 
 static int i10_delayed_doorbell_us __read_mostly = 50;
 static int i10_delayed_doorbell_us2 __read_mostly = 25;
@@ -41,6 +61,80 @@ module_param(i10_delayed_doorbell_us, int, 0644);
 MODULE_PARM_DESC(i10_delayed_doorbell_us,
 		"i10 delayed doorbell timer (us)");
 
+enum i10_host_doorbell_policy {
+	I10_HOST_DOORBELL_STATIC = 0,
+	I10_HOST_DOORBELL_LATENCY,
+	I10_HOST_DOORBELL_THROUGHPUT,
+};
+
+static int i10_doorbell_policy __read_mostly = I10_HOST_DOORBELL_STATIC;
+module_param(i10_doorbell_policy, int, 0644);
+MODULE_PARM_DESC(i10_doorbell_policy,
+		"i10 doorbell policy (0=static, 1=latency, 2=throughput)");
+
+static int i10_connect_fanout __read_mostly = 16;
+module_param(i10_connect_fanout, int, 0644);
+MODULE_PARM_DESC(i10_connect_fanout,
+		"I/O queues connected concurrently (1=one at a time)");
+
+static int i10_caravan_stage_max __read_mostly = 512;
+module_param(i10_caravan_stage_max, int, 0644);
+MODULE_PARM_DESC(i10_caravan_stage_max,
+		"PDUs and data up to this size are copied into the caravan (0=never)");
+
+static int i10_sockbuf_size __read_mostly;
+module_param(i10_sockbuf_size, int, 0644);
+MODULE_PARM_DESC(i10_sockbuf_size,
+		"fixed sndbuf/rcvbuf of each queue, 0 lets TCP autotune");
+
+static struct dentry *i10_host_debugfs_root;
+
+/*
+ * i10 lanes: every queue aggregates each traffic class into a caravan
+ * of its own, with its own capacity and doorbell.  Lanes are flushed in
+ * enum order, so lower values have priority.
+ */
+enum i10_host_lane {
+	I10_HOST_LANE_SYNC = 0,		/* flush/FUA and other no-delay I/O */
+	I10_HOST_LANE_READ,		/* reads below I10_BULK_READ_SIZE */
+	I10_HOST_LANE_WRITE,
+	I10_HOST_LANE_BULK_READ,
+	I10_HOST_NR_LANES,
+};
+
+struct i10_host_lane_profile {
+	const char		*name;
+	size_t			capacity;	/* caravan size in bytes */
+	int			batch;		/* default aggregation size */
+	int			*delay_us;	/* NULL rings immediately */
+};
+
+static const struct i10_host_lane_profile i10_host_lanes[I10_HOST_NR_LANES] = {
+	[I10_HOST_LANE_SYNC] = {
+		.name		= "sync",
+		.capacity	= I10_CARAVAN_CAPACITY,
+		.batch		= 1,
+	},
+	[I10_HOST_LANE_READ] = {
+		.name		= "read",
+		.capacity	= I10_CARAVAN2_CAPACITY,
+		.batch		= I10_AGGREGATION_SIZE2,
+		.delay_us	= &i10_delayed_doorbell_us2,
+	},
+	[I10_HOST_LANE_WRITE] = {
+		.name		= "write",
+		.capacity	= I10_CARAVAN_CAPACITY,
+		.batch		= I10_AGGREGATION_SIZE,
+		.delay_us	= &i10_delayed_doorbell_us,
+	},
+	[I10_HOST_LANE_BULK_READ] = {
+		.name		= "bulk_read",
+		.capacity	= I10_CARAVAN2_CAPACITY,
+		.batch		= I10_AGGREGATION_SIZE2,
+		.delay_us	= &i10_delayed_doorbell_us,
+	},
+};
+
 struct i10_host_queue;
 
 enum i10_host_send_state {
@@ -57,9 +151,14 @@ struct i10_host_request {
 	u32			data_len;
 	u32			pdu_len;
 	u32			pdu_sent;
+	u32			r2t_end;
 	u16			ttag;
 	struct list_head	entry;
-	u32			ddgst;
+	struct llist_node	lentry;
+	__le32			ddgst;
+	u64			start_ns;
+	enum i10_host_lane	lane;
+	bool			legacy;		/* see i10_host_legacy_path() */
 
 	struct bio		*curr_bio;
 	struct iov_iter		iter;
@@ -73,6 +172,21 @@ struct i10_host_request {
 enum i10_host_queue_flags {
 	I10_HOST_Q_ALLOCATED	= 0,
 	I10_HOST_Q_LIVE		= 1,
+	I10_HOST_Q_POLLING	= 2,
+};
+
+/*
+ * blk-mq queue maps, selected by i10_host_rq_flags_to_type().  With
+ * nr_write_queues the default set carries writes and the read set has
+ * TCP connections of its own, so reads never queue behind a write
+ * caravan.  All maps always exist; one without queues of its own, read
+ * or poll, maps onto the default set's.
+ */
+enum i10_host_queue_type {
+	I10_HOST_QUEUE_DEFAULT,
+	I10_HOST_QUEUE_READ,
+	I10_HOST_QUEUE_POLL,
+	I10_HOST_NR_QUEUE_TYPES,
 };
 
 enum i10_host_recv_state {
@@ -81,13 +195,104 @@ enum i10_host_recv_state {
 	I10_HOST_RECV_DDGST,
 };
 
+/* Why a caravan went out, see i10_host_flush_reason() */
+enum i10_host_flush_reason {
+	I10_HOST_FLUSH_FULL,
+	I10_HOST_FLUSH_NODELAY,
+	I10_HOST_FLUSH_TIMER,
+	I10_HOST_FLUSH_DRAINED,
+	I10_HOST_NR_FLUSH_REASONS,
+};
+
+static const char * const i10_host_flush_reason_names[] = {
+	[I10_HOST_FLUSH_FULL]		= "full",
+	[I10_HOST_FLUSH_NODELAY]	= "nodelay",
+	[I10_HOST_FLUSH_TIMER]		= "timer",
+	[I10_HOST_FLUSH_DRAINED]	= "drained",
+};
+
+#define I10_HOST_STATS_BUCKETS	8
+/* bytes buckets count 1K units, labeled by their lower bound: 0, 2K .. 128K */
+#define I10_HOST_STATS_BYTES_SHIFT	10
+
+/*
+ * Per-caravan statistics, read through debugfs.  The send side is only
+ * updated from io_work; the doorbell counters are bumped by submitters
+ * and the timer without locking, so they are approximate.
+ */
+struct i10_host_caravan_stats {
+	u64			bytes[I10_HOST_STATS_BUCKETS];	/* log2, 2K.. */
+	u64			iovs[I10_HOST_STATS_BUCKETS];	/* log2, 1.. */
+	u64			flushes[I10_HOST_NR_FLUSH_REASONS];
+	u64			timer_fires;
+	u64			early_rings;
+	u64			nospace;
+	u64			staged;		/* bytes copied into stage */
+	u64			flush_lat_ns;	/* first byte queued to sent */
+	u64			flush_lat_max_ns;
+};
+
+/*
+ * Per-caravan delayed doorbell controller.  It tracks the request
+ * inter-arrival time and completion latency and derives the doorbell
+ * delay and aggregation size from them according to i10_doorbell_policy.
+ */
+struct i10_host_doorbell {
+	int			delay_us;
+	int			batch;
+	u64			last_arrival_ns;
+	u64			gap_ns;
+	u64			lat_ns;
+};
+
+/* One i10 lane: a caravan of PDUs and the doorbell that sends it */
+struct i10_host_caravan {
+	struct i10_host_queue	*queue;
+	const struct i10_host_lane_profile *profile;
+
+	struct kvec		*iovs;
+	size_t			len;
+	size_t			sent;
+	int			nr_iovs;
+	bool			send_now;
+
+	struct page		**mapped;
+	int			nr_mapped;
+
+	/* Zero-copy caravans: data pages sent by reference, per iov */
+	struct bio_vec		*bvecs;
+
+	/* Small PDUs and data copied in, see i10_host_caravan_stage() */
+	void			*stage;
+	size_t			stage_len;
+	size_t			stage_size;
+
+	/* For i10 delayed doorbells */
+	int			nr_req;
+	int			nr_batch;	/* of the open blk-mq batch */
+	struct hrtimer		doorbell_timer;
+	struct i10_host_doorbell doorbell;
+	bool			timer_fired;
+
+	u64			first_ns;
+	struct i10_host_caravan_stats stats;
+};
+
+/* A completion parsed under the socket lock, see i10_host_end_comps() */
+struct i10_host_comp {
+	struct request		*rq;
+	__le16			status;
+	union nvme_result	result;
+};
+
 struct i10_host_ctrl;
 struct i10_host_queue {
 	struct socket		*sock;
 	struct work_struct	io_work;
 	int			io_cpu;
 
-	spinlock_t		lock;
+	/* submitters push to req_list, io_work drains it into send_list */
+	struct llist_head	req_list;
 	struct list_head	send_list;
 
 	/* recv state */
@@ -97,6 +302,17 @@ struct i10_host_queue {
 	size_t			data_remaining;
 	size_t			ddgst_remaining;
 
+	/* completions reaped by the current i10_host_poll() */
+	int			nr_cqe;
+
+	/*
+	 * completions of the current tcp_read_sock() pass; io_work and
+	 * pollers receive concurrently, so only touched under the socket
+	 * lock
+	 */
+	struct i10_host_comp	comps[I10_HOST_COMP_BATCH];
+	int			nr_comps;
+
 	/* send state */
 	struct i10_host_request *request;
 
@@ -108,41 +324,17 @@ struct i10_host_queue {
 
 	bool			hdr_digest;
 	bool			data_digest;
-	struct ahash_request	*rcv_hash;
-	struct ahash_request	*snd_hash;
+	u32			rcv_crc;	/* running crc32c digests */
+	u32			snd_crc;
 	__le32			exp_ddgst;
 	__le32			recv_ddgst;
 
-	/* For i10 caravans */
-	struct kvec		*caravan_iovs;
-	size_t			caravan_len;
-	int			nr_iovs;
-	bool			send_now;
-
-	struct page		**caravan_mapped;
-	int			nr_mapped;
-
-	//xiugai
-	/* For i10 caravans2 */
-	struct kvec		*caravan2_iovs;
-	size_t			caravan2_len;
-	int			nr_iovs2;
-	bool			send_now2;
-
-	struct page		**caravan2_mapped;
-	int			nr_mapped2;
-	//xiugai
+	/* For i10 lanes */
+	bool			zero_copy;
+	struct i10_host_caravan	caravans[I10_HOST_NR_LANES];
 
-	/* For i10 delayed doorbells */
-	int			nr_req;
-	struct hrtimer		doorbell_timer;
+	struct dentry		*debugfs_dir;
 
-	//xiugai
-	/* For i10 delayed doorbells2 */
-	int			nr_req2;
-	struct hrtimer		doorbell_timer2;
-	//xiugai
-	
 	struct page_frag_cache	pf_cache;
 
 	void (*state_change)(struct sock *);
@@ -166,6 +358,12 @@ struct i10_host_ctrl {
 	struct work_struct	err_work;
 	struct delayed_work	connect_work;
 	struct i10_host_request async_req;
+	u32			io_queues[I10_HOST_NR_QUEUE_TYPES];
+	int			last_io_cpu;
+	struct cpumask		io_cpus_used;	/* by placed I/O queues */
+	spinlock_t		io_cpu_lock;
+
+	struct dentry		*debugfs_dir;
 };
 
 static LIST_HEAD(i10_host_ctrl_list);
@@ -193,14 +391,43 @@ static inline struct blk_mq_tags *i10_host_tagset(struct i10_host_queue *queue)
 	return queue->ctrl->tag_set.tags[queue_idx - 1];
 }
 
+/*
+ * Digests are the exception, so their tests stay patched out of the PDU
+ * paths unless some queue actually negotiated one.
+ */
+static DEFINE_STATIC_KEY_FALSE(i10_host_digest_key);
+
+static inline bool i10_host_hdr_digest(struct i10_host_queue *queue)
+{
+	return static_branch_unlikely(&i10_host_digest_key) && queue->hdr_digest;
+}
+
+static inline bool i10_host_data_digest(struct i10_host_queue *queue)
+{
+	return static_branch_unlikely(&i10_host_digest_key) &&
+		queue->data_digest;
+}
+
+static void i10_host_digest_get(struct i10_host_queue *queue)
+{
+	if (queue->hdr_digest || queue->data_digest)
+		static_branch_inc(&i10_host_digest_key);
+}
+
+static void i10_host_digest_put(struct i10_host_queue *queue)
+{
+	if (queue->hdr_digest || queue->data_digest)
+		static_branch_dec(&i10_host_digest_key);
+}
+
 static inline u8 i10_host_hdgst_len(struct i10_host_queue *queue)
 {
-	return queue->hdr_digest ? NVME_TCP_DIGEST_LENGTH : 0;
+	return i10_host_hdr_digest(queue) ? NVME_TCP_DIGEST_LENGTH : 0;
 }
 
 static inline u8 i10_host_ddgst_len(struct i10_host_queue *queue)
 {
-	return queue->data_digest ? NVME_TCP_DIGEST_LENGTH : 0;
+	return i10_host_data_digest(queue) ? NVME_TCP_DIGEST_LENGTH : 0;
 }
 
 static inline size_t i10_host_inline_data_size(struct i10_host_queue *queue)
@@ -301,10 +528,16 @@ static inline void i10_host_advance_req(struct i10_host_request *req,
 	}
 }
 
+/*
+ * Whether @req bypasses the caravans.  Decided once per request in
+ * i10_host_setup_cmd_pdu(), so the PDU paths test a single flag and a
+ * change of i10_delayed_doorbell_us never splits a request across both
+ * paths.
+ */
 static inline bool i10_host_legacy_path(struct i10_host_request *req)
 {
 	return (i10_host_queue_id(req->queue) == 0) ||
-		(i10_delayed_doorbell_us < I10_MIN_DOORBELL_TIMEOUT);
+		(READ_ONCE(i10_delayed_doorbell_us) < I10_MIN_DOORBELL_TIMEOUT);
 }
 
 #define I10_ALLOWED_FLAGS (REQ_OP_READ | REQ_OP_WRITE | REQ_DRV | \
@@ -316,119 +549,316 @@ static bool i10_host_is_nodelay_path(struct i10_host_request *req)
 		(req->curr_bio->bi_opf & ~I10_ALLOWED_FLAGS);
 }
 
-static inline void i10_host_queue_request(struct i10_host_request *req)
+static enum i10_host_lane i10_host_req_lane(struct i10_host_request *req)
+{
+	struct request *rq = blk_mq_rq_from_pdu(req);
+
+	if (i10_host_is_nodelay_path(req))
+		return I10_HOST_LANE_SYNC;
+	if (rq_data_dir(rq) == WRITE)
+		return I10_HOST_LANE_WRITE;
+	if (req->data_len >= I10_BULK_READ_SIZE)
+		return I10_HOST_LANE_BULK_READ;
+	return I10_HOST_LANE_READ;
+}
+
+static inline struct i10_host_caravan *
+i10_host_req_caravan(struct i10_host_request *req)
+{
+	return &req->queue->caravans[req->lane];
+}
+
+static inline u64 i10_host_ewma(u64 avg, u64 sample)
+{
+	if (!avg)
+		return sample;
+	return avg - (avg >> I10_DOORBELL_EWMA_SHIFT) +
+		(sample >> I10_DOORBELL_EWMA_SHIFT);
+}
+
+static void i10_host_doorbell_init(struct i10_host_doorbell *db,
+		int delay_us, int batch)
+{
+	db->delay_us = delay_us;
+	db->batch = batch;
+	db->last_arrival_ns = 0;
+	db->gap_ns = 0;
+	db->lat_ns = 0;
+}
+
+/*
+ * Pick the doorbell delay and aggregation size for the next caravan.
+ * Called when the first request of a new caravan arrives.
+ */
+static void i10_host_doorbell_tune(struct i10_host_doorbell *db,
+		int base_us, int base_batch)
+{
+	u64 gap = READ_ONCE(db->gap_ns);
+	u64 lat = READ_ONCE(db->lat_ns);
+	u64 delay_ns;
+
+	switch (READ_ONCE(i10_doorbell_policy)) {
+	case I10_HOST_DOORBELL_LATENCY:
+		/*
+		 * Never hold a request for more than a quarter of the
+		 * observed completion latency, and ring right away if
+		 * no other request is expected within that window.
+		 */
+		delay_ns = (u64)base_us * NSEC_PER_USEC;
+		if (lat)
+			delay_ns = min(delay_ns, lat >> 2);
+		if (!gap || gap >= delay_ns) {
+			db->delay_us = 0;
+			db->batch = 1;
+			break;
+		}
+		db->delay_us = max_t(int, div_u64(delay_ns, NSEC_PER_USEC), 1);
+		db->batch = clamp_t(int, div64_u64(delay_ns, gap), 2,
+				base_batch);
+		break;
+	case I10_HOST_DOORBELL_THROUGHPUT:
+		/*
+		 * Batch whatever arrives within the base delay, but ring
+		 * as soon as the expected batch has been collected.
+		 */
+		delay_ns = (u64)base_us * NSEC_PER_USEC;
+		db->batch = gap ? clamp_t(int, div64_u64(delay_ns, gap),
+				base_batch, I10_AGGREGATION_MAX) : base_batch;
+		if (gap)
+			delay_ns = min(delay_ns, gap * db->batch);
+		db->delay_us = max_t(int, div_u64(delay_ns, NSEC_PER_USEC),
+				I10_MIN_DOORBELL_TIMEOUT);
+		break;
+	default:
+		db->delay_us = base_us;
+		db->batch = base_batch;
+		break;
+	}
+}
+
+static inline void i10_host_doorbell_arrival(struct i10_host_doorbell *db,
+		u64 now)
+{
+	u64 gap = now - db->last_arrival_ns;
+
+	if (db->last_arrival_ns)
+		db->gap_ns = i10_host_ewma(db->gap_ns,
+				min_t(u64, gap, I10_DOORBELL_MAX_GAP_NS));
+	db->last_arrival_ns = now;
+}
+
+static inline void i10_host_doorbell_complete(struct i10_host_queue *queue,
+		struct request *rq, u64 now)
+{
+	struct i10_host_request *req = blk_mq_rq_to_pdu(rq);
+	struct i10_host_doorbell *db = &queue->caravans[req->lane].doorbell;
+
+	if (!req->start_ns)
+		return;
+
+	WRITE_ONCE(db->lat_ns, i10_host_ewma(db->lat_ns, now - req->start_ns));
+	req->start_ns = 0;
+}
+
+/*
+ * bd->last closes the whole hctx batch, which may have spread over
+ * lanes, so every lane holding part of it rings: cancelling its timer is
+ * what lets i10_host_send_caravan() take it.  Returns true if any did.
+ */
+static bool i10_host_end_batch(struct i10_host_queue *queue)
+{
+	bool pending = false;
+	int i;
+
+	for (i = 0; i < I10_HOST_NR_LANES; i++) {
+		struct i10_host_caravan *caravan = &queue->caravans[i];
+
+		if (!caravan->nr_batch)
+			continue;
+		caravan->nr_batch = 0;
+		pending = true;
+
+		if (hrtimer_active(&caravan->doorbell_timer)) {
+			hrtimer_cancel(&caravan->doorbell_timer);
+			caravan->stats.early_rings++;
+			trace_i10_host_doorbell_cancelled(
+				queue->ctrl->ctrl.instance,
+				i10_host_queue_id(queue),
+				caravan->profile->name, caravan->nr_req,
+				caravan->doorbell.delay_us);
+		}
+	}
+	return pending;
+}
+
+/*
+ * @last is the blk-mq batch boundary (bd->last); requests queued from
+ * the driver itself (R2T, async events) pass true.
+ */
+static inline void i10_host_queue_request(struct i10_host_request *req,
+		bool last)
 {
 	struct i10_host_queue *queue = req->queue;
+	struct i10_host_caravan *caravan = i10_host_req_caravan(req);
+	const struct i10_host_lane_profile *profile = caravan->profile;
+	struct hrtimer *timer = &caravan->doorbell_timer;
+	bool batch = false;
+
+	llist_add(&req->lentry, &queue->req_list);
+
+	if (last && req->state == I10_HOST_SEND_CMD_PDU)
+		batch = i10_host_end_batch(queue);
 
-	spin_lock(&queue->lock);
-	list_add_tail(&req->entry, &queue->send_list);
-	spin_unlock(&queue->lock);
-
-	if (!i10_host_legacy_path(req) && !i10_host_is_nodelay_path(req)) {
-		printk(KERN_INFO "328!!!doorbell??");        //123456/*write doorbell2 work */
-		if(rq_data_dir(blk_mq_rq_from_pdu(req)) == WRITE)
-		{
-			queue->nr_req++;
-			printk(KERN_INFO "332!!!doorbellwrite");        //123456
-			/* Start a new delayed doorbell timer */
-			if (!hrtimer_active(&queue->doorbell_timer) &&
-				queue->nr_req == 1)
-				hrtimer_start(&queue->doorbell_timer,
-					ns_to_ktime(i10_delayed_doorbell_us *
-						NSEC_PER_USEC),
-					HRTIMER_MODE_REL);
-			/* Ring the delayed doorbell
-			* if I/O request counter >= i10 aggregation size
-			*/
-			else if (queue->nr_req >= I10_AGGREGATION_SIZE) {
-				if (hrtimer_active(&queue->doorbell_timer))
-					hrtimer_cancel(&queue->doorbell_timer);
-				queue_work_on(queue->io_cpu, i10_host_wq,
-						&queue->io_work);
+	if (!req->legacy && profile->delay_us) {
+		struct i10_host_doorbell *db = &caravan->doorbell;
+		bool ring = false;
+
+		/* Only new commands count as arrivals, not R2T requeues */
+		if (req->state == I10_HOST_SEND_CMD_PDU) {
+			u64 now = ktime_get_ns();
+			u64 prev = db->last_arrival_ns;
+
+			/*
+			 * Hold the doorbell while blk-mq is still handing us
+			 * a batch, and ring it as soon as the batch ends.  A
+			 * lone request on an idle lane has nothing to wait
+			 * for either, so it goes out right away too.
+			 */
+			if (!last) {
+				caravan->nr_batch++;
+			} else {
+				ring = batch || !prev ||
+					now - prev >= (u64)db->delay_us *
+						NSEC_PER_USEC;
 			}
+
+			i10_host_doorbell_arrival(db, now);
+			req->start_ns = now;
 		}
-		else
-		{	
-			printk(KERN_INFO "350!!!doorbellread?");        //123456/*read doorbell2 work */           //xiugai
-			queue->nr_req2++;
-			/* Start a new delayed doorbell timer */
-			if (!hrtimer_active(&queue->doorbell_timer2) &&
-				queue->nr_req2 == 1)
-				hrtimer_start(&queue->doorbell_timer2,
-					ns_to_ktime(i10_delayed_doorbell_us2 *
-						NSEC_PER_USEC),
-					HRTIMER_MODE_REL);
-			/* Ring the delayed doorbell
-			* if I/O request counter >= i10 aggregation size
-			*/
-			else if (queue->nr_req2 >= I10_AGGREGATION_SIZE2) {
-				if (hrtimer_active(&queue->doorbell_timer2))
-					hrtimer_cancel(&queue->doorbell_timer2);
-				queue_work_on(queue->io_cpu, i10_host_wq,
-						&queue->io_work);
+
+		if (++caravan->nr_req == 1)
+			i10_host_doorbell_tune(db, READ_ONCE(*profile->delay_us),
+				profile->batch);
+
+		/* Ring the delayed doorbell at the end of a batch
+		 * or if I/O request counter >= i10 aggregation size
+		 */
+		if (ring || caravan->nr_req >= db->batch || !db->delay_us) {
+			if (hrtimer_active(timer)) {
+				hrtimer_cancel(timer);
+				caravan->stats.early_rings++;
+				trace_i10_host_doorbell_cancelled(
+					queue->ctrl->ctrl.instance,
+					i10_host_queue_id(queue), profile->name,
+					caravan->nr_req, db->delay_us);
 			}
-		}																							//xiugai
-		
+			queue_work_on(queue->io_cpu, i10_host_wq,
+					&queue->io_work);
+		}
+		/* Start a new delayed doorbell timer; it also covers a
+		 * batch that blk-mq never closes with bd->last
+		 */
+		else if (!hrtimer_active(timer) && caravan->nr_req == 1) {
+			hrtimer_start(timer,
+				ns_to_ktime(db->delay_us * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+			trace_i10_host_doorbell_armed(queue->ctrl->ctrl.instance,
+				i10_host_queue_id(queue), profile->name,
+				caravan->nr_req, db->delay_us);
+		}
 	}
 	/* Ring the doorbell immediately for no-delay path */
 	else {
-		if(rq_data_dir(blk_mq_rq_from_pdu(req)) == WRITE)
-		{
-			printk(KERN_INFO "ringwritedoorbell!!!immidiate"); //123456
-			if (hrtimer_active(&queue->doorbell_timer))
-			hrtimer_cancel(&queue->doorbell_timer);
-		}
-		else
-		{
-			printk(KERN_INFO "ringreaddoorbell!!!immidiate");  //123456
-			if (hrtimer_active(&queue->doorbell_timer2))
-			hrtimer_cancel(&queue->doorbell_timer2);
-		}
-		printk(KERN_INFO "386!!!immidiate");
+		if (hrtimer_active(timer))
+			hrtimer_cancel(timer);
 		queue_work_on(queue->io_cpu, i10_host_wq, &queue->io_work);
 	}
 }
 
+static void i10_host_process_req_list(struct i10_host_queue *queue)
+{
+	struct i10_host_request *req;
+	struct llist_node *node;
+
+	/* llist_del_all() hands back LIFO order, list_add() restores FIFO */
+	for (node = llist_del_all(&queue->req_list); node; node = node->next) {
+		req = llist_entry(node, struct i10_host_request, lentry);
+		list_add(&req->entry, &queue->send_list);
+	}
+}
+
 static inline struct i10_host_request *
 i10_host_fetch_request(struct i10_host_queue *queue)
 {
 	struct i10_host_request *req;
 
-	spin_lock(&queue->lock);
 	req = list_first_entry_or_null(&queue->send_list,
 			struct i10_host_request, entry);
-	if (req)
-		list_del(&req->entry);
-	spin_unlock(&queue->lock);
+	if (!req) {
+		i10_host_process_req_list(queue);
+		req = list_first_entry_or_null(&queue->send_list,
+				struct i10_host_request, entry);
+		if (unlikely(!req))
+			return NULL;
+	}
+
+	list_del(&req->entry);
 
 	return req;
 }
 
-static inline void i10_host_ddgst_final(struct ahash_request *hash, u32 *dgst)
+/*
+ * Digests are plain crc32c() calls on a running u32 rather than ahash
+ * requests: no scatterlist or request setup per PDU, and the library
+ * still picks the SSE4.2/PCLMUL implementation where there is one.
+ */
+static inline void i10_host_ddgst_init(u32 *crc)
+{
+	*crc = ~0;
+}
+
+static inline void i10_host_ddgst_final(u32 crc, __le32 *dgst)
 {
-	ahash_request_set_crypt(hash, NULL, (u8 *)dgst, 0);
-	crypto_ahash_final(hash);
+	*dgst = cpu_to_le32(~crc);
 }
 
-static inline void i10_host_ddgst_update(struct ahash_request *hash,
-		struct page *page, off_t off, size_t len)
+static inline void i10_host_ddgst_update(u32 *crc, struct page *page,
+		off_t off, size_t len)
 {
-	struct scatterlist sg;
+	void *vaddr = kmap_atomic(page);
 
-	sg_init_marker(&sg, 1);
-	sg_set_page(&sg, page, len, off);
-	ahash_request_set_crypt(hash, &sg, NULL, len);
-	crypto_ahash_update(hash);
+	*crc = crc32c(*crc, vaddr + off, len);
+	kunmap_atomic(vaddr);
 }
 
-static inline void i10_host_hdgst(struct ahash_request *hash,
-		void *pdu, size_t len)
+static __wsum i10_host_skb_crc_update(const void *mem, int len, __wsum crc)
 {
-	struct scatterlist sg;
+	return (__force __wsum)crc32c((__force u32)crc, mem, len);
+}
 
-	sg_init_one(&sg, pdu, len);
-	ahash_request_set_crypt(hash, &sg, pdu + len, len);
-	crypto_ahash_digest(hash);
+static __wsum i10_host_skb_crc_combine(__wsum crc, __wsum crc2,
+		int offset, int len)
+{
+	return (__force __wsum)__crc32c_le_combine((__force u32)crc,
+			(__force u32)crc2, len);
+}
+
+static const struct skb_checksum_ops i10_host_skb_crc_ops = {
+	.update		= i10_host_skb_crc_update,
+	.combine	= i10_host_skb_crc_combine,
+};
+
+/* Fold @len bytes of @skb into a data digest, straight from the skb */
+static inline void i10_host_ddgst_skb(u32 *crc, struct sk_buff *skb,
+		int offset, int len)
+{
+	*crc = (__force u32)__skb_checksum(skb, offset, len,
+			(__force __wsum)*crc, &i10_host_skb_crc_ops);
+}
+
+static inline void i10_host_hdgst(void *pdu, size_t len)
+{
+	*(__le32 *)(pdu + len) = cpu_to_le32(~crc32c(~0, pdu, len));
 }
 
 static int i10_host_verify_hdgst(struct i10_host_queue *queue,
@@ -446,7 +876,7 @@ static int i10_host_verify_hdgst(struct i10_host_queue *queue,
 	}
 
 	recv_digest = *(__le32 *)(pdu + hdr->hlen);
-	i10_host_hdgst(queue->rcv_hash, pdu, pdu_len);
+	i10_host_hdgst(pdu, pdu_len);
 	exp_digest = *(__le32 *)(pdu + hdr->hlen);
 	if (recv_digest != exp_digest) {
 		dev_err(queue->ctrl->ctrl.device,
@@ -473,7 +903,7 @@ static int i10_host_check_ddgst(struct i10_host_queue *queue, void *pdu)
 		i10_host_queue_id(queue));
 		return -EPROTO;
 	}
-	crypto_ahash_init(queue->rcv_hash);
+	i10_host_ddgst_init(&queue->rcv_crc);
 
 	return 0;
 }
@@ -553,9 +983,34 @@ static void i10_host_error_recovery(struct nvme_ctrl *ctrl)
 	queue_work(nvme_wq, &to_i10_host_ctrl(ctrl)->err_work);
 }
 
+/*
+ * Finish the completions collected by a receive pass, with the socket
+ * still locked.  Ended back to back, the requests of one submitting CPU
+ * can share its completion IPI, and the doorbell latency is sampled with
+ * one clock read.
+ */
+static void i10_host_end_comps(struct i10_host_queue *queue)
+{
+	u64 now;
+	int i;
+
+	if (!queue->nr_comps)
+		return;
+
+	now = ktime_get_ns();
+	for (i = 0; i < queue->nr_comps; i++) {
+		struct i10_host_comp *comp = &queue->comps[i];
+
+		i10_host_doorbell_complete(queue, comp->rq, now);
+		nvme_end_request(comp->rq, comp->status, comp->result);
+	}
+	queue->nr_comps = 0;
+}
+
 static int i10_host_process_nvme_cqe(struct i10_host_queue *queue,
 		struct nvme_completion *cqe)
 {
+	struct i10_host_comp *comp;
 	struct request *rq;
 
 	rq = blk_mq_tag_to_rq(i10_host_tagset(queue), cqe->command_id);
@@ -567,7 +1022,13 @@ static int i10_host_process_nvme_cqe(struct i10_host_queue *queue,
 		return -EINVAL;
 	}
 
-	nvme_end_request(rq, cqe->status, cqe->result);
+	if (queue->nr_comps == I10_HOST_COMP_BATCH)
+		i10_host_end_comps(queue);
+	comp = &queue->comps[queue->nr_comps++];
+	comp->rq = rq;
+	comp->status = cqe->status;
+	comp->result = cqe->result;
+	queue->nr_cqe++;
 
 	return 0;
 }
@@ -623,19 +1084,14 @@ static int i10_host_handle_comp(struct i10_host_queue *queue,
 static int i10_host_setup_h2c_data_pdu(struct i10_host_request *req,
 		struct nvme_tcp_r2t_pdu *pdu)
 {
-	struct nvme_tcp_data_pdu *data = req->pdu;
 	struct i10_host_queue *queue = req->queue;
 	struct request *rq = blk_mq_rq_from_pdu(req);
-	u8 hdgst = i10_host_hdgst_len(queue);
-	u8 ddgst = i10_host_ddgst_len(queue);
+	u32 r2t_length = le32_to_cpu(pdu->r2t_length);
 
-	req->pdu_len = le32_to_cpu(pdu->r2t_length);
-	req->pdu_sent = 0;
-
-	if (unlikely(req->data_sent + req->pdu_len > req->data_len)) {
+	if (unlikely(req->data_sent + r2t_length > req->data_len)) {
 		dev_err(queue->ctrl->ctrl.device,
 			"req %d r2t len %u exceeded data len %u (%zu sent)\n",
-			rq->tag, req->pdu_len, req->data_len,
+			rq->tag, r2t_length, req->data_len,
 			req->data_sent);
 		return -EPROTO;
 	}
@@ -648,22 +1104,45 @@ static int i10_host_setup_h2c_data_pdu(struct i10_host_request *req,
 		return -EPROTO;
 	}
 
+	req->ttag = pdu->ttag;
+	req->r2t_end = req->data_sent + r2t_length;
+	return 0;
+}
+
+/*
+ * Build the next H2C data PDU of the current R2T.  On caravan queues a
+ * large R2T is split into I10_H2C_DATA_CHUNK sized PDUs so it can be
+ * interleaved with other requests; see i10_host_done_send_data().
+ */
+static void i10_host_setup_h2c_chunk(struct i10_host_request *req)
+{
+	struct nvme_tcp_data_pdu *data = req->pdu;
+	struct i10_host_queue *queue = req->queue;
+	struct request *rq = blk_mq_rq_from_pdu(req);
+	u8 hdgst = i10_host_hdgst_len(queue);
+	u8 ddgst = i10_host_ddgst_len(queue);
+
+	req->pdu_len = req->r2t_end - req->data_sent;
+	if (!req->legacy)
+		req->pdu_len = min_t(u32, req->pdu_len, I10_H2C_DATA_CHUNK);
+	req->pdu_sent = 0;
+
 	memset(data, 0, sizeof(*data));
 	data->hdr.type = nvme_tcp_h2c_data;
-	data->hdr.flags = NVME_TCP_F_DATA_LAST;
-	if (queue->hdr_digest)
+	if (req->data_sent + req->pdu_len == req->r2t_end)
+		data->hdr.flags = NVME_TCP_F_DATA_LAST;
+	if (i10_host_hdr_digest(queue))
 		data->hdr.flags |= NVME_TCP_F_HDGST;
-	if (queue->data_digest)
+	if (i10_host_data_digest(queue))
 		data->hdr.flags |= NVME_TCP_F_DDGST;
 	data->hdr.hlen = sizeof(*data);
 	data->hdr.pdo = data->hdr.hlen + hdgst;
 	data->hdr.plen =
 		cpu_to_le32(data->hdr.hlen + hdgst + req->pdu_len + ddgst);
-	data->ttag = pdu->ttag;
+	data->ttag = req->ttag;
 	data->command_id = rq->tag;
 	data->data_offset = cpu_to_le32(req->data_sent);
 	data->data_length = cpu_to_le32(req->pdu_len);
-	return 0;
 }
 
 static int i10_host_handle_r2t(struct i10_host_queue *queue,
@@ -689,7 +1168,7 @@ static int i10_host_handle_r2t(struct i10_host_queue *queue,
 	req->state = I10_HOST_SEND_H2C_PDU;
 	req->offset = 0;
 
-	i10_host_queue_request(req);
+	i10_host_queue_request(req, true);
 
 	return 0;
 }
@@ -715,14 +1194,14 @@ static int i10_host_recv_pdu(struct i10_host_queue *queue, struct sk_buff *skb,
 		return 0;
 
 	hdr = queue->pdu;
-	if (queue->hdr_digest) {
+	if (i10_host_hdr_digest(queue)) {
 		ret = i10_host_verify_hdgst(queue, queue->pdu, hdr->hlen);
 		if (unlikely(ret))
 			return ret;
 	}
 
 
-	if (queue->data_digest) {
+	if (i10_host_data_digest(queue)) {
 		ret = i10_host_check_ddgst(queue, queue->pdu);
 		if (unlikely(ret))
 			return ret;
@@ -794,11 +1273,7 @@ static int i10_host_recv_data(struct i10_host_queue *queue, struct sk_buff *skb,
 		recv_len = min_t(size_t, recv_len,
 				iov_iter_count(&req->iter));
 
-		if (queue->data_digest)
-			ret = skb_copy_and_hash_datagram_iter(skb, *offset,
-				&req->iter, recv_len, queue->rcv_hash);
-		else
-			ret = skb_copy_datagram_iter(skb, *offset,
+		ret = skb_copy_datagram_iter(skb, *offset,
 				&req->iter, recv_len);
 		if (ret) {
 			dev_err(queue->ctrl->ctrl.device,
@@ -806,6 +1281,9 @@ static int i10_host_recv_data(struct i10_host_queue *queue, struct sk_buff *skb,
 				i10_host_queue_id(queue), rq->tag);
 			return ret;
 		}
+		if (i10_host_data_digest(queue))
+			i10_host_ddgst_skb(&queue->rcv_crc, skb, *offset,
+					recv_len);
 
 		*len -= recv_len;
 		*offset += recv_len;
@@ -813,8 +1291,8 @@ static int i10_host_recv_data(struct i10_host_queue *queue, struct sk_buff *skb,
 	}
 
 	if (!queue->data_remaining) {
-		if (queue->data_digest) {
-			i10_host_ddgst_final(queue->rcv_hash, &queue->exp_ddgst);
+		if (i10_host_data_digest(queue)) {
+			i10_host_ddgst_final(queue->rcv_crc, &queue->exp_ddgst);
 			queue->ddgst_remaining = NVME_TCP_DIGEST_LENGTH;
 		} else {
 			i10_host_init_recv_ctx(queue);
@@ -893,7 +1371,9 @@ static void i10_host_data_ready(struct sock *sk)
 
 	read_lock(&sk->sk_callback_lock);
 	queue = sk->sk_user_data;
-	if (likely(queue && queue->rd_enabled))
+	/* a polling submitter is already reaping this socket */
+	if (likely(queue && queue->rd_enabled) &&
+	    !test_bit(I10_HOST_Q_POLLING, &queue->flags))
 		queue_work_on(queue->io_cpu, i10_host_wq, &queue->io_work);
 	read_unlock(&sk->sk_callback_lock);
 }
@@ -945,6 +1425,26 @@ static inline void i10_host_done_send_req(struct i10_host_queue *queue)
 	queue->request = NULL;
 }
 
+/*
+ * A data PDU has been handed off.  If its R2T is not done yet, flush
+ * the caravan before the PDU header is rebuilt for the next chunk, and
+ * requeue the request behind whatever is already waiting so small
+ * commands do not sit behind a large write.
+ */
+static void i10_host_done_send_data(struct i10_host_request *req)
+{
+	struct i10_host_queue *queue = req->queue;
+
+	i10_host_done_send_req(queue);
+	if (req->data_sent >= req->r2t_end)
+		return;
+
+	i10_host_req_caravan(req)->send_now = true;
+	req->state = I10_HOST_SEND_H2C_PDU;
+	req->offset = 0;
+	i10_host_queue_request(req, true);
+}
+
 static void i10_host_fail_request(struct i10_host_request *req)
 {
 	union nvme_result res = {};
@@ -953,20 +1453,91 @@ static void i10_host_fail_request(struct i10_host_request *req)
 		NVME_SC_DATA_XFER_ERROR, res);
 }
 
-static inline bool i10_host_is_caravan_full(struct i10_host_queue *queue)
+static inline bool i10_host_is_caravan_full(struct i10_host_caravan *caravan)
 {
-	printk(KERN_INFO "956!!!caravanfull???");        //123456
-	return (queue->caravan_len >= I10_CARAVAN_CAPACITY) ||
-		(queue->nr_iovs >= I10_AGGREGATION_SIZE * 2) ||
-		(queue->nr_mapped >= I10_AGGREGATION_SIZE);
+	return caravan->sent ||
+		(caravan->len >= caravan->profile->capacity) ||
+		(caravan->nr_iovs >= I10_AGGREGATION_MAX * 2) ||
+		(caravan->nr_mapped >= I10_AGGREGATION_MAX);
 }
-static inline bool i10_host_is_caravan2_full(struct i10_host_queue *queue)					//xiugai
+
+/*
+ * Copy @len bytes at @base into the caravan's staging buffer if they are
+ * small enough and fit.  What is staged next to the previous iov extends
+ * it, so runs of PDUs (completions, or commands and their in-capsule data
+ * once the data is small enough too) go out as a single kvec instead of
+ * many tiny ones.  Larger data still goes by reference.
+ */
+static bool i10_host_caravan_stage(struct i10_host_caravan *caravan,
+		const void *base, size_t len)
+{
+	void *dst = caravan->stage + caravan->stage_len;
+	struct kvec *last;
+
+	if (len > READ_ONCE(i10_caravan_stage_max) ||
+	    len > caravan->stage_size - caravan->stage_len)
+		return false;
+
+	memcpy(dst, base, len);
+	caravan->stage_len += len;
+	caravan->stats.staged += len;
+	if (!caravan->len)
+		caravan->first_ns = ktime_get_ns();
+	caravan->len += len;
+
+	if (caravan->nr_iovs) {
+		last = &caravan->iovs[caravan->nr_iovs - 1];
+		if (last->iov_base && last->iov_base + last->iov_len == dst) {
+			last->iov_len += len;
+			return true;
+		}
+	}
+	caravan->iovs[caravan->nr_iovs].iov_base = dst;
+	caravan->iovs[caravan->nr_iovs++].iov_len = len;
+	return true;
+}
+
+/* Queue @len bytes by reference; @base is NULL for a zero-copy bvec */
+static inline void __i10_host_caravan_add(struct i10_host_caravan *caravan,
+		void *base, size_t len)
+{
+	if (!caravan->len)
+		caravan->first_ns = ktime_get_ns();
+	caravan->iovs[caravan->nr_iovs].iov_base = base;
+	caravan->iovs[caravan->nr_iovs++].iov_len = len;
+	caravan->len += len;
+}
+
+static inline void i10_host_caravan_add(struct i10_host_caravan *caravan,
+		void *base, size_t len)
 {
-	printk(KERN_INFO "963!!!caravan2full???");        //123456
-	return (queue->caravan2_len >= I10_CARAVAN2_CAPACITY) ||
-		(queue->nr_iovs2 >= I10_AGGREGATION_SIZE2 * 2) ||
-		(queue->nr_mapped2 >= I10_AGGREGATION_SIZE2);
-}																				//xiugai
+	if (!i10_host_caravan_stage(caravan, base, len))
+		__i10_host_caravan_add(caravan, base, len);
+}
+
+static inline void i10_host_caravan_add_page(struct i10_host_caravan *caravan,
+		struct page *page, size_t offset, size_t len)
+{
+	if (len <= READ_ONCE(i10_caravan_stage_max)) {
+		void *vaddr = kmap_atomic(page);
+		bool staged;
+
+		staged = i10_host_caravan_stage(caravan, vaddr + offset, len);
+		kunmap_atomic(vaddr);
+		if (staged)
+			return;
+	}
+
+	if (caravan->bvecs) {
+		caravan->bvecs[caravan->nr_iovs].bv_page = page;
+		caravan->bvecs[caravan->nr_iovs].bv_offset = offset;
+		__i10_host_caravan_add(caravan, NULL, len);
+	} else {
+		caravan->mapped[caravan->nr_mapped++] = page;
+		__i10_host_caravan_add(caravan, kmap(page) + offset, len);
+	}
+}
+
 static int i10_host_try_send_data(struct i10_host_request *req)
 {
 	struct i10_host_queue *queue = req->queue;
@@ -977,26 +1548,25 @@ static int i10_host_try_send_data(struct i10_host_request *req)
 		size_t len = i10_host_req_cur_length(req);
 		bool last = i10_host_pdu_last_send(req, len);
 		int ret, flags = MSG_DONTWAIT;
-		printk(KERN_INFO "978i10_host_try_send_data");        //123456
-		if (last && !queue->data_digest)
+
+		if (last && !i10_host_data_digest(queue))
 			flags |= MSG_EOR;
 		else
 			flags |= MSG_MORE;
 
-		if (i10_host_legacy_path(req))
+		if (req->legacy)
 			ret = kernel_sendpage(queue->sock, page, offset,
 						len, flags);
-		else if(req->pdu_len<=32768){
-			if (i10_host_is_caravan_full(queue)) {
-				queue->send_now = true;
+		else {
+			struct i10_host_caravan *caravan =
+				i10_host_req_caravan(req);
+
+			if (i10_host_is_caravan_full(caravan)) {
+				caravan->send_now = true;
 				return 1;
 			}
 			/* Caravans: I/O data aggregation */
-			queue->caravan_iovs[queue->nr_iovs].iov_base =
-				kmap(page) + offset;
-			queue->caravan_iovs[queue->nr_iovs++].iov_len = len;
-			queue->caravan_mapped[queue->nr_mapped++] = page;
-			queue->caravan_len += len;
+			i10_host_caravan_add_page(caravan, page, offset, len);
 			ret = len;
 		}
 	
@@ -1004,19 +1574,19 @@ static int i10_host_try_send_data(struct i10_host_request *req)
 			return ret;
 
 		i10_host_advance_req(req, ret);
-		if (queue->data_digest)
-			i10_host_ddgst_update(queue->snd_hash, page,
+		if (i10_host_data_digest(queue))
+			i10_host_ddgst_update(&queue->snd_crc, page,
 					offset, ret);
 
 		/* fully successful last write*/
 		if (last && ret == len) {
-			if (queue->data_digest) {
-				i10_host_ddgst_final(queue->snd_hash,
+			if (i10_host_data_digest(queue)) {
+				i10_host_ddgst_final(queue->snd_crc,
 					&req->ddgst);
 				req->state = I10_HOST_SEND_DDGST;
 				req->offset = 0;
 			} else {
-				i10_host_done_send_req(queue);
+				i10_host_done_send_data(req);
 			}
 			return 1;
 		}
@@ -1034,65 +1604,33 @@ static int i10_host_try_send_cmd_pdu(struct i10_host_request *req)
 	int len = sizeof(*pdu) + hdgst - req->offset;
 	int ret;
 
-	if (queue->hdr_digest && !req->offset)
-		i10_host_hdgst(queue->snd_hash, pdu, sizeof(*pdu));
+	if (i10_host_hdr_digest(queue) && !req->offset)
+		i10_host_hdgst(pdu, sizeof(*pdu));
 
-	if (i10_host_legacy_path(req))
+	if (req->legacy)
 		ret = kernel_sendpage(queue->sock, virt_to_page(pdu),
 			offset_in_page(pdu) + req->offset, len, flags);		
-	/* read and write IO operation */	
-	else {	
-		if(rq_data_dir(blk_mq_rq_from_pdu(req)) == WRITE)
-		{
-			printk(KERN_INFO "1046!!!cmdwrite");       //123456/* write IO operation */
-			if (i10_host_is_caravan_full(queue)) {
-				queue->send_now = true;
-				return 1;
-			}
-			//printk(KERN_INFO "1051!!!");        //123456/* Caravans: command PDU aggregation */
-			queue->caravan_iovs[queue->nr_iovs].iov_base = pdu
-				+ req->offset;
-			queue->caravan_iovs[queue->nr_iovs++].iov_len = len;
-			queue->caravan_len += len;
-			ret = len;
-			if (i10_host_is_nodelay_path(req))
-			{
-				printk(KERN_INFO "!!writenodelay_path");     //123456
-				queue->send_now = true;
-			}
-		}	
-		else
-		{
-			printk(KERN_INFO "1061!!!cmdread");        //123456/* read IO operation */											//xiugai
-			if (i10_host_is_caravan2_full(queue)) {
-				queue->send_now2 = true;
-				return 1;
-			}
-			//printk(KERN_INFO "1068!!!");        //123456/* Caravans: command PDU aggregation */
-			queue->caravan2_iovs[queue->nr_iovs2].iov_base = pdu
-				+ req->offset;
-			queue->caravan2_iovs[queue->nr_iovs2++].iov_len = len;
-			queue->caravan2_len += len;
-			ret = len;
-			//printk(KERN_INFO "1074!!!");        //123456
-			if (i10_host_is_nodelay_path(req))
-			{
-				printk(KERN_INFO "!!!readnodelay_path");        //123456
-				queue->send_now2 = true;
-			}
+	else {
+		struct i10_host_caravan *caravan = i10_host_req_caravan(req);
+
+		if (i10_host_is_caravan_full(caravan)) {
+			caravan->send_now = true;
+			return 1;
 		}
-		printk(KERN_INFO "1078!!!cmdfinish");        //123456
-	}																												//xiugai
-	printk(KERN_INFO "ret %d\n",ret);        //123456
+		/* Caravans: command PDU aggregation */
+		i10_host_caravan_add(caravan, (void *)pdu + req->offset, len);
+		ret = len;
+		if (!caravan->profile->delay_us)
+			caravan->send_now = true;
+	}
 	if (unlikely(ret <= 0))
 		return ret;
-	printk(KERN_INFO "len %d\n",len);        //123456
 	len -= ret;
 	if (!len) {
 		if (inline_data) {
 			req->state = I10_HOST_SEND_DATA;
-			if (queue->data_digest)
-				crypto_ahash_init(queue->snd_hash);
+			if (i10_host_data_digest(queue))
+				i10_host_ddgst_init(&queue->snd_crc);
 			i10_host_init_iter(req, WRITE);
 		} else {
 			i10_host_done_send_req(queue);
@@ -1111,25 +1649,27 @@ static int i10_host_try_send_data_pdu(struct i10_host_request *req)
 	u8 hdgst = i10_host_hdgst_len(queue);
 	int len = sizeof(*pdu) - req->offset + hdgst;
 	int ret;
-	printk(KERN_INFO "1112!!!i10_host_try_send_data_pdu");    //123456
-	if (queue->hdr_digest && !req->offset)
-		i10_host_hdgst(queue->snd_hash, pdu, sizeof(*pdu));
 
-	if (i10_host_legacy_path(req))
+	if (!req->offset) {
+		i10_host_setup_h2c_chunk(req);
+		if (i10_host_hdr_digest(queue))
+			i10_host_hdgst(pdu, sizeof(*pdu));
+	}
+
+	if (req->legacy)
 		ret = kernel_sendpage(queue->sock, virt_to_page(pdu),
 			offset_in_page(pdu) + req->offset, len,
 			MSG_DONTWAIT | MSG_MORE);
 	/* write IO operation*/
 	else {
-		if (i10_host_is_caravan_full(queue)) {
-			queue->send_now = true;
+		struct i10_host_caravan *caravan = i10_host_req_caravan(req);
+
+		if (i10_host_is_caravan_full(caravan)) {
+			caravan->send_now = true;
 			return 1;
 		}
 		/* Caravans: data PDU aggregation */
-		queue->caravan_iovs[queue->nr_iovs].iov_base = pdu
-			+ req->offset;
-		queue->caravan_iovs[queue->nr_iovs++].iov_len = len;
-		queue->caravan_len += len;
+		i10_host_caravan_add(caravan, (void *)pdu + req->offset, len);
 		ret = len;
 	}
 
@@ -1139,8 +1679,8 @@ static int i10_host_try_send_data_pdu(struct i10_host_request *req)
 	len -= ret;
 	if (!len) {
 		req->state = I10_HOST_SEND_DATA;
-		if (queue->data_digest)
-			crypto_ahash_init(queue->snd_hash);
+		if (i10_host_data_digest(queue))
+			i10_host_ddgst_init(&queue->snd_crc);
 		if (!req->data_sent)
 			i10_host_init_iter(req, WRITE);
 		return 1;
@@ -1156,52 +1696,232 @@ static int i10_host_try_send_ddgst(struct i10_host_request *req)
 	int ret;
 	struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_EOR };
 	struct kvec iov = {
-		.iov_base = &req->ddgst + req->offset,
+		.iov_base = (u8 *)&req->ddgst + req->offset,
 		.iov_len = NVME_TCP_DIGEST_LENGTH - req->offset
 	};
 
+	/*
+	 * The data went into the caravan, so the digest has to follow it
+	 * there to keep the stream in order.
+	 */
+	if (!req->legacy) {
+		struct i10_host_caravan *caravan = i10_host_req_caravan(req);
+
+		if (i10_host_is_caravan_full(caravan)) {
+			caravan->send_now = true;
+			return 1;
+		}
+		i10_host_caravan_add(caravan, iov.iov_base, iov.iov_len);
+		i10_host_done_send_data(req);
+		return 1;
+	}
+
 	ret = kernel_sendmsg(queue->sock, &msg, &iov, 1, iov.iov_len);
 	if (unlikely(ret <= 0))
 		return ret;
 
 	if (req->offset + ret == NVME_TCP_DIGEST_LENGTH) {
-		i10_host_done_send_req(queue);
+		i10_host_done_send_data(req);
 		return 1;
 	}
 
-	req->offset += ret;
-	return -EAGAIN;
+	req->offset += ret;
+	return -EAGAIN;
+}
+
+/*
+ * Push as much of a caravan as the socket accepts, starting at its
+ * cursor.  Runs of kvecs are copied with sock_sendmsg(), while iovs that
+ * have a page in bvecs (zero-copy caravans) go out through
+ * kernel_sendpage().  Returns 1 once the whole caravan is on the wire,
+ * 0 if the rest has to wait for write_space, or a negative errno.
+ */
+static int i10_host_push_caravan(struct i10_host_caravan *caravan)
+{
+	struct i10_host_queue *queue = caravan->queue;
+	struct kvec *iovs = caravan->iovs;
+	struct bio_vec *pages = caravan->bvecs;
+	size_t skip = caravan->sent;
+	int i = 0, n, ret;
+
+	/* Find where the previous send stopped */
+	while (i < caravan->nr_iovs && skip >= iovs[i].iov_len)
+		skip -= iovs[i++].iov_len;
+
+	while (caravan->sent < caravan->len) {
+		int flags = MSG_DONTWAIT;
+		size_t seg;
+
+		if (pages && pages[i].bv_page) {
+			n = 1;
+			seg = iovs[i].iov_len - skip;
+			if (caravan->sent + seg < caravan->len)
+				flags |= MSG_MORE | MSG_SENDPAGE_NOTLAST;
+			else
+				flags |= MSG_EOR;
+			ret = kernel_sendpage(queue->sock, pages[i].bv_page,
+					pages[i].bv_offset + skip, seg, flags);
+		} else {
+			struct msghdr msg = {};
+
+			for (n = 0, seg = 0; i + n < caravan->nr_iovs &&
+			     !(pages && pages[i + n].bv_page); n++)
+				seg += iovs[i + n].iov_len;
+			seg -= skip;
+
+			msg.msg_flags = flags |
+				(caravan->sent + seg < caravan->len ?
+				 MSG_MORE : MSG_EOR);
+			iov_iter_kvec(&msg.msg_iter, WRITE, &iovs[i], n,
+					seg + skip);
+			iov_iter_advance(&msg.msg_iter, skip);
+			ret = sock_sendmsg(queue->sock, &msg);
+		}
+
+		if (ret == -EAGAIN)
+			return 0;
+		if (unlikely(ret < 0)) {
+			dev_err(queue->ctrl->ctrl.device,
+				"I10_HOST: %s caravan send fails (ret %d)\n",
+				caravan->profile->name, ret);
+			return ret;
+		}
+
+		caravan->sent += ret;
+		if (ret < seg)
+			return 0;
+		i += n;
+		skip = 0;
+	}
+	return 1;
+}
+
+static enum i10_host_flush_reason
+i10_host_flush_reason(struct i10_host_caravan *caravan)
+{
+	if (i10_host_is_caravan_full(caravan))
+		return I10_HOST_FLUSH_FULL;
+	if (caravan->send_now)
+		return I10_HOST_FLUSH_NODELAY;
+	if (READ_ONCE(caravan->timer_fired))
+		return I10_HOST_FLUSH_TIMER;
+	return I10_HOST_FLUSH_DRAINED;
+}
+
+static inline int i10_host_stats_bucket(unsigned long v)
+{
+	return v ? min_t(int, ilog2(v), I10_HOST_STATS_BUCKETS - 1) : 0;
+}
+
+/* Account (and trace) a caravan as it starts going out */
+static void i10_host_stats_flush(struct i10_host_caravan *caravan)
+{
+	struct i10_host_caravan_stats *stats = &caravan->stats;
+	enum i10_host_flush_reason reason = i10_host_flush_reason(caravan);
+
+	trace_i10_host_caravan_flush(caravan->queue->ctrl->ctrl.instance,
+		i10_host_queue_id(caravan->queue), caravan->profile->name,
+		caravan->len, caravan->nr_iovs,
+		i10_host_flush_reason_names[reason], caravan->first_ns);
+
+	stats->flushes[reason]++;
+	stats->bytes[i10_host_stats_bucket(caravan->len >>
+		I10_HOST_STATS_BYTES_SHIFT)]++;
+	stats->iovs[i10_host_stats_bucket(caravan->nr_iovs)]++;
+}
+
+/* ... and once it is completely on the wire */
+static void i10_host_stats_sent(struct i10_host_caravan *caravan)
+{
+	struct i10_host_caravan_stats *stats = &caravan->stats;
+	u64 lat = ktime_get_ns() - caravan->first_ns;
+
+	stats->flush_lat_ns += lat;
+	if (lat > stats->flush_lat_max_ns)
+		stats->flush_lat_max_ns = lat;
+}
+
+static int i10_host_flush_caravan(struct i10_host_caravan *caravan)
+{
+	int i, ret;
+
+	if (!caravan->sent)
+		i10_host_stats_flush(caravan);
+
+	ret = i10_host_push_caravan(caravan);
+	if (!ret)
+		caravan->stats.nospace++;
+	if (ret <= 0)
+		return ret;
+
+	i10_host_stats_sent(caravan);
+
+	for (i = 0; i < caravan->nr_mapped; i++)
+		kunmap(caravan->mapped[i]);
+	if (caravan->bvecs)
+		memset(caravan->bvecs, 0,
+			caravan->nr_iovs * sizeof(*caravan->bvecs));
+
+	caravan->nr_req = 0;
+	caravan->nr_iovs = 0;
+	caravan->nr_mapped = 0;
+	caravan->len = 0;
+	caravan->sent = 0;
+	caravan->stage_len = 0;
+	caravan->send_now = false;
+	WRITE_ONCE(caravan->timer_fired, false);
+	return 1;
+}
+
+static bool i10_host_send_caravan(struct i10_host_caravan *caravan)
+{
+	/* 1. Caravan becomes full, or
+	 * 2. No-delay request arrives, or
+	 * 3. No more request remains in i10 queue, or
+	 * 4. It is already partially sent
+	 */
+	return caravan->send_now || caravan->sent ||
+		(!hrtimer_active(&caravan->doorbell_timer) &&
+		!caravan->queue->request && caravan->len);
 }
 
-/* To check if there's enough room in tcp_sndbuf */
-static inline int i10_host_sndbuf_nospace(struct i10_host_queue *queue,
-		int length)
+static bool i10_host_caravans_pending(struct i10_host_queue *queue)
 {
-	return sk_stream_wspace(queue->sock->sk) < length;
+	int i;
+
+	for (i = 0; i < I10_HOST_NR_LANES; i++)
+		if (queue->caravans[i].len)
+			return true;
+	return false;
 }
 
-static bool i10_host_send_caravan(struct i10_host_queue *queue)
+static int i10_host_flush_caravans(struct i10_host_queue *queue)
 {
-	/* 1. Caravan becomes full (64KB), or
-	 * 2. No-delay request arrives, or
-	 * 3. No more request remains in i10 queue
+	int i, ret;
+
+	/*
+	 * Caravans may go out in several pieces.  Once one has started it
+	 * must finish before any other, so resume it first.
 	 */
-	printk(KERN_INFO "1183!!!i10_host_send_caravan");        //123456
-	return queue->send_now ||
-		(!hrtimer_active(&queue->doorbell_timer) &&
-		!queue->request && queue->caravan_len);
-}	
+	for (i = 0; i < I10_HOST_NR_LANES; i++) {
+		if (!queue->caravans[i].sent)
+			continue;
+		ret = i10_host_flush_caravan(&queue->caravans[i]);
+		if (ret <= 0)
+			return ret;
+	}
+
+	/* Send i10 caravans now, in lane priority order */
+	for (i = 0; i < I10_HOST_NR_LANES; i++) {
+		if (!i10_host_send_caravan(&queue->caravans[i]))
+			continue;
+		ret = i10_host_flush_caravan(&queue->caravans[i]);
+		if (ret <= 0)
+			return ret;
+	}
+	return 1;
+}
 
-static bool i10_host_send_caravan2(struct i10_host_queue *queue)																//xiugai
-{
-	/* 1. Caravan2 becomes full (8MB), or
-	 * 2. No-delay request arrives, or
-	 * 3. No more request remains in i10 queue */
-	printk(KERN_INFO "1193!!!i10_host_send_caravan2");        //123456
-	return queue->send_now2 ||
-		(!hrtimer_active(&queue->doorbell_timer2) &&
-		!queue->request && queue->caravan2_len);
-}																														//xiugai
 static int i10_host_try_send(struct i10_host_queue *queue)
 {
 	struct i10_host_request *req;
@@ -1209,75 +1929,14 @@ static int i10_host_try_send(struct i10_host_queue *queue)
 
 	if (!queue->request) {
 		queue->request = i10_host_fetch_request(queue);
-		if (!queue->request && !queue->caravan_len && !queue->caravan2_len)     ///123456 warning
+		if (!queue->request && !i10_host_caravans_pending(queue))
 			return 0;
 	}
 
-	/* Send i10 caravans now */
-	if (i10_host_send_caravan(queue)) {
-		struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_EOR };
-		int i, i10_ret;
-		printk(KERN_INFO "1218!!send_caravan!!!");        //123456
-		if (i10_host_sndbuf_nospace(queue, queue->caravan_len)) {
-			set_bit(SOCK_NOSPACE,
-				&queue->sock->sk->sk_socket->flags);
-			return 0;
-		}
-
-		i10_ret = kernel_sendmsg(queue->sock, &msg,
-				queue->caravan_iovs,
-				queue->nr_iovs,
-				queue->caravan_len);
-
-		if (unlikely(i10_ret <= 0)) {
-			dev_err(queue->ctrl->ctrl.device,
-				"I10_HOST: kernel_sendmsg fails (i10_ret %d)\n",
-				i10_ret);
-			return i10_ret;
-		}
+	ret = i10_host_flush_caravans(queue);
+	if (ret <= 0)
+		return ret;
 
-		for (i = 0; i < queue->nr_mapped; i++)
-			kunmap(queue->caravan_mapped[i]);
-		printk(KERN_INFO "1218!!send_caravanfinish!!!");        //123456
-		queue->nr_req = 0;
-		queue->nr_iovs = 0;
-		queue->nr_mapped = 0;
-		queue->caravan_len = 0;
-		queue->send_now = false;
-	}
-	/* Send i10 caravans2 now */																							//xiugai
-	if (i10_host_send_caravan2(queue)) {
-		struct msghdr msg2 = { .msg_flags = MSG_DONTWAIT | MSG_EOR };
-		int i2, i10_ret2;
-		printk(KERN_INFO "1247!!!");        //123456
-		if (i10_host_sndbuf_nospace(queue, queue->caravan2_len)) {
-			set_bit(SOCK_NOSPACE,
-				&queue->sock->sk->sk_socket->flags);
-			return 0;
-		}
-		printk(KERN_INFO "1253!!!");        //123456
-		i10_ret2 = kernel_sendmsg(queue->sock, &msg2,
-				queue->caravan2_iovs,
-				queue->nr_iovs2,
-				queue->caravan2_len);
-		printk(KERN_INFO "1258!!!");        //123456
-		if (unlikely(i10_ret2 <= 0)) {
-			dev_err(queue->ctrl->ctrl.device,
-				"i10_HOST: kernel_sendmsg fails (i10_ret2 %d)\n",
-				i10_ret2);
-			return i10_ret2;
-		}
-		printk(KERN_INFO "1265!!!");        //123456
-		for (i2 = 0; i2 < queue->nr_mapped2; i2++)
-			kunmap(queue->caravan2_mapped[i2]);
-		printk(KERN_INFO "1268!!!");        //123456
-		queue->nr_req2 = 0;
-		queue->nr_iovs2 = 0;
-		queue->nr_mapped2 = 0;
-		queue->caravan2_len = 0;
-		queue->send_now2 = false;
-	}
-	printk(KERN_INFO "1275!!!");        //123456																					//xiugai
 	if (queue->request)
 		req = queue->request;
 	else
@@ -1321,29 +1980,26 @@ static int i10_host_try_recv(struct i10_host_queue *queue)
 	rd_desc.count = 1;
 	lock_sock(sk);
 	consumed = tcp_read_sock(sk, &rd_desc, i10_host_recv_skb);
+	i10_host_end_comps(queue);
 	release_sock(sk);
 	return consumed;
 }
 
 enum hrtimer_restart i10_host_doorbell_timeout(struct hrtimer *timer)
 {
-	struct i10_host_queue *queue =
-		container_of(timer, struct i10_host_queue,
+	struct i10_host_caravan *caravan =
+		container_of(timer, struct i10_host_caravan,
 			doorbell_timer);
-	printk(KERN_INFO "1327!!!");        //123456
-	queue_work_on(queue->io_cpu, i10_host_wq, &queue->io_work);
-	return HRTIMER_NORESTART;
-}
+	struct i10_host_queue *queue = caravan->queue;
 
-enum hrtimer_restart i10_host_doorbell_timeout2(struct hrtimer *timer)												//xiugai
-{
-	struct i10_host_queue *queue =
-		container_of(timer, struct i10_host_queue,
-			doorbell_timer2);
-	printk(KERN_INFO "1338!!!i10_host_doorbell_timeout2");        //123456
+	caravan->stats.timer_fires++;
+	trace_i10_host_doorbell_fired(queue->ctrl->ctrl.instance,
+		i10_host_queue_id(queue), caravan->profile->name,
+		caravan->nr_req, caravan->doorbell.delay_us);
+	WRITE_ONCE(caravan->timer_fired, true);
 	queue_work_on(queue->io_cpu, i10_host_wq, &queue->io_work);
 	return HRTIMER_NORESTART;
-}																												//xiugai
+}
 
 static void i10_host_io_work(struct work_struct *w)
 {
@@ -1354,24 +2010,21 @@ static void i10_host_io_work(struct work_struct *w)
 	do {
 		bool pending = false;
 		int result;
-		printk(KERN_INFO "start to send");        //123456
+
 		result = i10_host_try_send(queue);
 		if (result > 0) {
-			printk(KERN_INFO "pending");        //123456
 			pending = true;
 		} else if (unlikely(result < 0)) {
 			dev_err(queue->ctrl->ctrl.device,
 				"failed to send request %d\n", result);
-			if (result != -EPIPE)
+			if (result != -EPIPE && queue->request)
 				i10_host_fail_request(queue->request);
 			i10_host_done_send_req(queue);
 			return;
 		}
-		printk(KERN_INFO "start to recv");        //123456
 		result = i10_host_try_recv(queue);
 		if (result > 0)
 			pending = true;
-		printk(KERN_INFO "restart one io");        //123456
 		if (!pending)
 			return;
 
@@ -1380,41 +2033,6 @@ static void i10_host_io_work(struct work_struct *w)
 	queue_work_on(queue->io_cpu, i10_host_wq, &queue->io_work);
 }
 
-static void i10_host_free_crypto(struct i10_host_queue *queue)
-{
-	struct crypto_ahash *tfm = crypto_ahash_reqtfm(queue->rcv_hash);
-
-	ahash_request_free(queue->rcv_hash);
-	ahash_request_free(queue->snd_hash);
-	crypto_free_ahash(tfm);
-}
-
-static int i10_host_alloc_crypto(struct i10_host_queue *queue)
-{
-	struct crypto_ahash *tfm;
-
-	tfm = crypto_alloc_ahash("crc32c", 0, CRYPTO_ALG_ASYNC);
-	if (IS_ERR(tfm))
-		return PTR_ERR(tfm);
-
-	queue->snd_hash = ahash_request_alloc(tfm, GFP_KERNEL);
-	if (!queue->snd_hash)
-		goto free_tfm;
-	ahash_request_set_callback(queue->snd_hash, 0, NULL, NULL);
-
-	queue->rcv_hash = ahash_request_alloc(tfm, GFP_KERNEL);
-	if (!queue->rcv_hash)
-		goto free_snd_hash;
-	ahash_request_set_callback(queue->rcv_hash, 0, NULL, NULL);
-
-	return 0;
-free_snd_hash:
-	ahash_request_free(queue->snd_hash);
-free_tfm:
-	crypto_free_ahash(tfm);
-	return -ENOMEM;
-}
-
 static void i10_host_free_async_req(struct i10_host_ctrl *ctrl)
 {
 	struct i10_host_request *async = &ctrl->async_req;
@@ -1438,6 +2056,69 @@ static int i10_host_alloc_async_req(struct i10_host_ctrl *ctrl)
 	return 0;
 }
 
+static void i10_host_free_caravans(struct i10_host_queue *queue)
+{
+	int i;
+
+	for (i = 0; i < I10_HOST_NR_LANES; i++) {
+		struct i10_host_caravan *caravan = &queue->caravans[i];
+
+		hrtimer_cancel(&caravan->doorbell_timer);
+		kfree(caravan->iovs);
+		kfree(caravan->mapped);
+		kfree(caravan->bvecs);
+		kfree(caravan->stage);
+	}
+}
+
+static int i10_host_alloc_caravans(struct i10_host_queue *queue)
+{
+	int i;
+
+	/* i10 delayed doorbell setup */
+	for (i = 0; i < I10_HOST_NR_LANES; i++) {
+		struct i10_host_caravan *caravan = &queue->caravans[i];
+		const struct i10_host_lane_profile *profile = &i10_host_lanes[i];
+
+		memset(caravan, 0, sizeof(*caravan));
+		caravan->queue = queue;
+		caravan->profile = profile;
+		hrtimer_init(&caravan->doorbell_timer, CLOCK_MONOTONIC,
+				HRTIMER_MODE_REL);
+		caravan->doorbell_timer.function = &i10_host_doorbell_timeout;
+		i10_host_doorbell_init(&caravan->doorbell,
+			profile->delay_us ? *profile->delay_us : 0,
+			profile->batch);
+	}
+
+	/* i10 caravan initialization */
+	for (i = 0; i < I10_HOST_NR_LANES; i++) {
+		struct i10_host_caravan *caravan = &queue->caravans[i];
+
+		caravan->iovs = kcalloc(I10_AGGREGATION_MAX * 2,
+				sizeof(*caravan->iovs), GFP_KERNEL);
+		caravan->mapped = kcalloc(I10_AGGREGATION_MAX,
+				sizeof(*caravan->mapped), GFP_KERNEL);
+		caravan->stage_size = min_t(size_t, caravan->profile->capacity,
+				I10_CARAVAN_STAGE_MAX);
+		caravan->stage = kmalloc(caravan->stage_size, GFP_KERNEL);
+		if (!caravan->iovs || !caravan->mapped || !caravan->stage)
+			goto err_free;
+
+		if (queue->zero_copy) {
+			caravan->bvecs = kcalloc(I10_AGGREGATION_MAX * 2,
+					sizeof(*caravan->bvecs), GFP_KERNEL);
+			if (!caravan->bvecs)
+				goto err_free;
+		}
+	}
+	return 0;
+
+err_free:
+	i10_host_free_caravans(queue);
+	return -ENOMEM;
+}
+
 static void i10_host_free_queue(struct nvme_ctrl *nctrl, int qid)
 {
 	struct i10_host_ctrl *ctrl = to_i10_host_ctrl(nctrl);
@@ -1446,22 +2127,11 @@ static void i10_host_free_queue(struct nvme_ctrl *nctrl, int qid)
 	if (!test_and_clear_bit(I10_HOST_Q_ALLOCATED, &queue->flags))
 		return;
 
-	if (queue->hdr_digest || queue->data_digest)
-		i10_host_free_crypto(queue);
-	printk(KERN_INFO "free queue %d\n",qid);        //123456
 	sock_release(queue->sock);
 	kfree(queue->pdu);
-	kfree(queue->caravan_iovs);
-	kfree(queue->caravan_mapped);
-	printk(KERN_INFO "1450!!!");        //123456																	//xiugai
-	hrtimer_cancel(&queue->doorbell_timer);
-	kfree(queue->caravan2_iovs);
-	printk(KERN_INFO "1453!!!");        //123456
-	kfree(queue->caravan2_mapped);
-	printk(KERN_INFO "1455!!!");        //123456
-	hrtimer_cancel(&queue->doorbell_timer2);
-	printk(KERN_INFO "1457!!!");        //123456
-}																												//xiugai
+	i10_host_digest_put(queue);
+	i10_host_free_caravans(queue);
+}
 
 static int i10_host_init_connection(struct i10_host_queue *queue)
 {
@@ -1561,6 +2231,51 @@ free_icreq:
 	return ret;
 }
 
+static bool i10_host_io_cpu_taken(struct i10_host_ctrl *ctrl, int cpu)
+{
+	return cpumask_test_cpu(cpu, &ctrl->io_cpus_used);
+}
+
+/*
+ * Place an I/O queue's io_work once the connection is up.  An explicit
+ * io_cpus list wins.  Otherwise run on the CPU that took the socket's
+ * RX softirq (the NIC queue's IRQ/RSS target), which also makes XPS
+ * pick the matching TX queue, and spread any collisions over that
+ * CPU's NUMA node.
+ */
+static void i10_host_set_io_cpu(struct i10_host_queue *queue)
+{
+	struct i10_host_ctrl *ctrl = queue->ctrl;
+	const struct cpumask *mask = &ctrl->ctrl.opts->io_cpus;
+	int qid = i10_host_queue_id(queue);
+	int cpu = READ_ONCE(queue->sock->sk->sk_incoming_cpu);
+
+	if (qid == 0)
+		return;
+
+	/* queues connect concurrently, see i10_host_setup_io_queues() */
+	spin_lock(&ctrl->io_cpu_lock);
+	if (!cpumask_intersects(mask, cpu_online_mask)) {
+		if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+			goto out_unlock;
+		if (!i10_host_io_cpu_taken(ctrl, cpu))
+			goto out_set;
+		mask = cpumask_of_node(cpu_to_node(cpu));
+	}
+
+	cpu = cpumask_next_and(ctrl->last_io_cpu, mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first_and(mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		goto out_unlock;
+	ctrl->last_io_cpu = cpu;
+out_set:
+	queue->io_cpu = cpu;
+	cpumask_set_cpu(cpu, &ctrl->io_cpus_used);
+out_unlock:
+	spin_unlock(&ctrl->io_cpu_lock);
+}
+
 static int i10_host_alloc_queue(struct nvme_ctrl *nctrl,
 		int qid, size_t queue_size)
 {
@@ -1570,8 +2285,8 @@ static int i10_host_alloc_queue(struct nvme_ctrl *nctrl,
 	int ret, opt, rcv_pdu_size;
 
 	queue->ctrl = ctrl;
+	init_llist_head(&queue->req_list);
 	INIT_LIST_HEAD(&queue->send_list);
-	spin_lock_init(&queue->lock);
 	INIT_WORK(&queue->io_work, i10_host_io_work);
 	queue->queue_size = queue_size;
 
@@ -1609,23 +2324,30 @@ static int i10_host_alloc_queue(struct nvme_ctrl *nctrl,
 		goto err_sock;
 	}
 
-	/* Set a fixed size of sndbuf/rcvbuf (8MB) */
-	opt = 8388608;
-	ret = kernel_setsockopt(queue->sock, SOL_SOCKET, SO_SNDBUFFORCE,
-			(char *)&opt, sizeof(opt));
-	if (ret) {
-		dev_err(ctrl->ctrl.device,
-			"failed to set SO_SNDBUFFORCE sock opt %d\n", ret);
-		goto err_sock;
-	}
+	/*
+	 * A fixed sndbuf/rcvbuf pins that much for every queue, busy or
+	 * not, so by default TCP sizes them itself.
+	 */
+	opt = READ_ONCE(i10_sockbuf_size);
+	if (opt > 0) {
+		ret = kernel_setsockopt(queue->sock, SOL_SOCKET,
+				SO_SNDBUFFORCE, (char *)&opt, sizeof(opt));
+		if (ret) {
+			dev_err(ctrl->ctrl.device,
+				"failed to set SO_SNDBUFFORCE sock opt %d\n",
+				ret);
+			goto err_sock;
+		}
 
-	ret = kernel_setsockopt(queue->sock, SOL_SOCKET, SO_RCVBUFFORCE,
-			(char *)&opt, sizeof(opt));
-	if (ret) {
-		dev_err(ctrl->ctrl.device,
-			"failed to set SO_RCVBUFFORCE sock opt %d\n", ret);
-		goto err_sock;
-	}	
+		ret = kernel_setsockopt(queue->sock, SOL_SOCKET,
+				SO_RCVBUFFORCE, (char *)&opt, sizeof(opt));
+		if (ret) {
+			dev_err(ctrl->ctrl.device,
+				"failed to set SO_RCVBUFFORCE sock opt %d\n",
+				ret);
+			goto err_sock;
+		}
+	}
 
 	/*
 	 * Cleanup whatever is sitting in the TCP transmit queue on socket
@@ -1641,12 +2363,13 @@ static int i10_host_alloc_queue(struct nvme_ctrl *nctrl,
 	}
 
 	queue->sock->sk->sk_allocation = GFP_ATOMIC;
-	queue->io_cpu = (qid == 0) ? 0 : qid - 1;
+	queue->io_cpu = (qid == 0) ? 0 : (qid - 1) % num_online_cpus();
 	queue->request = NULL;
 	queue->data_remaining = 0;
 	queue->ddgst_remaining = 0;
 	queue->pdu_remaining = 0;
 	queue->pdu_offset = 0;
+	queue->nr_comps = 0;
 	sk_set_memalloc(queue->sock->sk);
 
 	if (ctrl->ctrl.opts->mask & NVMF_OPT_HOST_TRADDR) {
@@ -1660,73 +2383,22 @@ static int i10_host_alloc_queue(struct nvme_ctrl *nctrl,
 		}
 	}
 
-	/* i10 initialization */
-	queue->caravan_iovs = kcalloc(I10_AGGREGATION_SIZE * 2,
-				sizeof(*queue->caravan_iovs), GFP_KERNEL);
-	if (!queue->caravan_iovs) {
-		ret = -ENOMEM;
+	/* i10 initialization; zero-copy is only used on I/O queues */
+	queue->zero_copy = nctrl->opts->zero_copy && qid > 0;
+	ret = i10_host_alloc_caravans(queue);
+	if (ret)
 		goto err_sock;
-	}
-
-	queue->caravan_mapped = kcalloc(I10_AGGREGATION_SIZE,
-				sizeof(**queue->caravan_mapped), GFP_KERNEL);
-	if (!queue->caravan_mapped) {
-		ret = -ENOMEM;
-		goto err_caravan_iovs;
-	}
-
-	queue->nr_req = 0;
-	queue->nr_iovs = 0;
-	queue->nr_mapped = 0;
-	queue->caravan_len = 0;
-	queue->send_now = false;
 
-	/* caravan2 initialization */     //111111																			//xiugai
-	queue->caravan2_iovs = kcalloc(I10_AGGREGATION_SIZE2 * 2,
-				sizeof(*queue->caravan2_iovs), GFP_KERNEL);
-	if (!queue->caravan2_iovs) {
-		ret = -ENOMEM;
-		goto err_caravan_mapped;
-	}
-	
-	queue->caravan2_mapped = kcalloc(I10_AGGREGATION_SIZE2,
-				sizeof(**queue->caravan2_mapped), GFP_KERNEL);
-	if (!queue->caravan2_mapped) {
-		ret = -ENOMEM;
-		goto err_caravan2_iovs;
-	}
-
-	queue->nr_req2 = 0;
-	queue->nr_iovs2 = 0;
-	queue->nr_mapped2 = 0;
-	queue->caravan2_len = 0;
-	queue->send_now2 = false;	    //999999
-	printk(KERN_INFO "1681!!!one");        //123456																		//xiugai
-	/* i10 delayed doorbell setup */
-	hrtimer_init(&queue->doorbell_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	queue->doorbell_timer.function = &i10_host_doorbell_timeout;
-
-	/* caravan2 delayed doorbell setup */																			//xiugai
-	hrtimer_init(&queue->doorbell_timer2, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-	queue->doorbell_timer2.function = &i10_host_doorbell_timeout2;
-	printk(KERN_INFO "1700!!!two");        //123456																	//xiugai
 	queue->hdr_digest = nctrl->opts->hdr_digest;
 	queue->data_digest = nctrl->opts->data_digest;
-	if (queue->hdr_digest || queue->data_digest) {
-		ret = i10_host_alloc_crypto(queue);
-		if (ret) {
-			dev_err(ctrl->ctrl.device,
-				"failed to allocate queue %d crypto\n", qid);
-			goto err_caravan2_mapped;
-		}
-	}
+	i10_host_digest_get(queue);
 
 	rcv_pdu_size = sizeof(struct nvme_tcp_rsp_pdu) +
 			i10_host_hdgst_len(queue);
 	queue->pdu = kmalloc(rcv_pdu_size, GFP_KERNEL);
 	if (!queue->pdu) {
 		ret = -ENOMEM;
-		goto err_crypto;
+		goto err_caravans;
 	}
 
 	dev_dbg(ctrl->ctrl.device, "connecting queue %d\n",
@@ -1744,6 +2416,7 @@ static int i10_host_alloc_queue(struct nvme_ctrl *nctrl,
 	if (ret)
 		goto err_init_connect;
 
+	i10_host_set_io_cpu(queue);
 	queue->rd_enabled = true;
 	set_bit(I10_HOST_Q_ALLOCATED, &queue->flags);
 	i10_host_init_recv_ctx(queue);
@@ -1764,20 +2437,9 @@ err_init_connect:
 	kernel_sock_shutdown(queue->sock, SHUT_RDWR);
 err_rcv_pdu:
 	kfree(queue->pdu);
-err_crypto:
-	if (queue->hdr_digest || queue->data_digest)
-		i10_host_free_crypto(queue);
-err_caravan2_mapped:																	//xiugai
-	kfree(queue->caravan2_mapped);
-	printk(KERN_INFO "1762!!!");        //123456															
-err_caravan2_iovs:
-	kfree(queue->caravan2_iovs);
-	printk(KERN_INFO "1765!!!");        //123456
-err_caravan_mapped:
-	kfree(queue->caravan_mapped);
-	printk(KERN_INFO "1768!!!");        //123456										//xiugai
-err_caravan_iovs:
-	kfree(queue->caravan_iovs);
+err_caravans:
+	i10_host_digest_put(queue);
+	i10_host_free_caravans(queue);
 err_sock:
 	sock_release(queue->sock);
 	queue->sock = NULL;
@@ -1787,7 +2449,7 @@ err_sock:
 static void i10_host_restore_sock_calls(struct i10_host_queue *queue)
 {
 	struct socket *sock = queue->sock;
-	printk(KERN_INFO "i10_host_restore_sock_calls");        //123456
+
 	write_lock_bh(&sock->sk->sk_callback_lock);
 	sock->sk->sk_user_data  = NULL;
 	sock->sk->sk_data_ready = queue->data_ready;
@@ -1798,7 +2460,6 @@ static void i10_host_restore_sock_calls(struct i10_host_queue *queue)
 
 static void __i10_host_stop_queue(struct i10_host_queue *queue)
 {
-	printk(KERN_INFO "__i10_host_stop_queue");        //123456
 	kernel_sock_shutdown(queue->sock, SHUT_RDWR);
 	i10_host_restore_sock_calls(queue);
 	cancel_work_sync(&queue->io_work);
@@ -1808,7 +2469,7 @@ static void i10_host_stop_queue(struct nvme_ctrl *nctrl, int qid)
 {
 	struct i10_host_ctrl *ctrl = to_i10_host_ctrl(nctrl);
 	struct i10_host_queue *queue = &ctrl->queues[qid];
-	printk(KERN_INFO "i10_host_stop_queue");        //123456
+
 	if (!test_and_clear_bit(I10_HOST_Q_LIVE, &queue->flags))
 		return;
 
@@ -1865,6 +2526,8 @@ static struct blk_mq_tag_set *i10_host_alloc_tagset(struct nvme_ctrl *nctrl,
 		set->driver_data = ctrl;
 		set->nr_hw_queues = nctrl->queue_count - 1;
 		set->timeout = NVME_IO_TIMEOUT;
+		/* all of them, see i10_host_map_queues() */
+		set->nr_maps = I10_HOST_NR_QUEUE_TYPES;
 	}
 
 	ret = blk_mq_alloc_tag_set(set);
@@ -1880,14 +2543,13 @@ static void i10_host_free_admin_queue(struct nvme_ctrl *ctrl)
 		i10_host_free_async_req(to_i10_host_ctrl(ctrl));
 		to_i10_host_ctrl(ctrl)->async_req.pdu = NULL;
 	}
-	printk(KERN_INFO "i10_host_free_admin_queue");        //123456
 	i10_host_free_queue(ctrl, 0);
 }
 
 static void i10_host_free_io_queues(struct nvme_ctrl *ctrl)
 {
 	int i;
-	printk(KERN_INFO "i10_host_free_io_queues");        //123456
+
 	for (i = 1; i < ctrl->queue_count; i++)
 		i10_host_free_queue(ctrl, i);
 }
@@ -1895,26 +2557,86 @@ static void i10_host_free_io_queues(struct nvme_ctrl *ctrl)
 static void i10_host_stop_io_queues(struct nvme_ctrl *ctrl)
 {
 	int i;
-	printk(KERN_INFO "i10_host_stop_io_queues");        //123456
+
 	for (i = 1; i < ctrl->queue_count; i++)
 		i10_host_stop_queue(ctrl, i);
 }
 
-static int i10_host_start_io_queues(struct nvme_ctrl *ctrl)
+/* One I/O queue being set up by i10_host_setup_io_queues() */
+struct i10_host_queue_setup {
+	struct work_struct	work;
+	struct nvme_ctrl	*ctrl;
+	int			qid;
+	int			(*fn)(struct nvme_ctrl *ctrl, int qid);
+	int			ret;
+};
+
+static void i10_host_queue_setup_work(struct work_struct *w)
 {
-	int i, ret = 0;
-	printk(KERN_INFO "i10_host_start_io_queues");        //123456
-	for (i = 1; i < ctrl->queue_count; i++) {
-		ret = i10_host_start_queue(ctrl, i);
-		if (ret)
-			goto out_stop_queues;
+	struct i10_host_queue_setup *setup =
+		container_of(w, struct i10_host_queue_setup, work);
+
+	setup->ret = setup->fn(setup->ctrl, setup->qid);
+}
+
+/*
+ * Run @fn on every I/O queue, i10_connect_fanout queues at a time, so
+ * that the TCP handshake, ICReq and Connect round trips of the queues
+ * overlap.  Each queue reports its own error; the one of the lowest
+ * failed qid is returned once its window has finished.
+ */
+static int i10_host_setup_io_queues(struct nvme_ctrl *ctrl,
+		int (*fn)(struct nvme_ctrl *ctrl, int qid))
+{
+	int nr_queues = ctrl->queue_count - 1;
+	struct i10_host_queue_setup *setups = NULL;
+	int fanout, i, j, ret = 0;
+
+	fanout = clamp(READ_ONCE(i10_connect_fanout), 1, max(nr_queues, 1));
+	if (fanout > 1)
+		setups = kcalloc(fanout, sizeof(*setups), GFP_KERNEL);
+	if (!setups) {
+		for (i = 1; i < ctrl->queue_count; i++) {
+			ret = fn(ctrl, i);
+			if (ret)
+				return ret;
+		}
+		return 0;
 	}
 
-	return 0;
+	for (i = 1; i < ctrl->queue_count && !ret; i += fanout) {
+		int nr = min(fanout, ctrl->queue_count - i);
 
-out_stop_queues:
-	for (i--; i >= 1; i--)
-		i10_host_stop_queue(ctrl, i);
+		for (j = 0; j < nr; j++) {
+			setups[j].ctrl = ctrl;
+			setups[j].qid = i + j;
+			setups[j].fn = fn;
+			setups[j].ret = 0;
+			INIT_WORK(&setups[j].work, i10_host_queue_setup_work);
+			queue_work(system_unbound_wq, &setups[j].work);
+		}
+
+		for (j = 0; j < nr; j++) {
+			flush_work(&setups[j].work);
+			if (setups[j].ret && !ret)
+				ret = setups[j].ret;
+		}
+	}
+
+	kfree(setups);
+	return ret;
+}
+
+static int i10_host_start_io_queues(struct nvme_ctrl *ctrl)
+{
+	int i, ret;
+
+	ret = i10_host_setup_io_queues(ctrl, i10_host_start_queue);
+	if (ret) {
+		/* stops whichever queues made it to live */
+		for (i = 1; i < ctrl->queue_count; i++)
+			i10_host_stop_queue(ctrl, i);
+	}
 	return ret;
 }
 
@@ -1937,29 +2659,64 @@ out_free_queue:
 	return ret;
 }
 
+static int i10_host_alloc_io_queue(struct nvme_ctrl *ctrl, int qid)
+{
+	return i10_host_alloc_queue(ctrl, qid, ctrl->sqsize + 1);
+}
+
 static int i10_host_alloc_io_queues(struct nvme_ctrl *ctrl)
 {
 	int i, ret;
 
-	for (i = 1; i < ctrl->queue_count; i++) {
-		ret = i10_host_alloc_queue(ctrl, i,
-				ctrl->sqsize + 1);
-		if (ret)
-			goto out_free_queues;
+	to_i10_host_ctrl(ctrl)->last_io_cpu = -1;
+	cpumask_clear(&to_i10_host_ctrl(ctrl)->io_cpus_used);
+
+	ret = i10_host_setup_io_queues(ctrl, i10_host_alloc_io_queue);
+	if (ret) {
+		/* frees whichever queues got allocated */
+		for (i = 1; i < ctrl->queue_count; i++)
+			i10_host_free_queue(ctrl, i);
 	}
+	return ret;
+}
 
-	return 0;
+static unsigned int i10_host_nr_io_queues(struct nvme_ctrl *ctrl)
+{
+	unsigned int nr_io_queues;
 
-out_free_queues:
-	for (i--; i >= 1; i--)
-		i10_host_free_queue(ctrl, i);
+	nr_io_queues = min(ctrl->opts->nr_io_queues, num_online_cpus());
+	nr_io_queues += min(ctrl->opts->nr_write_queues, num_online_cpus());
+	nr_io_queues += min(ctrl->opts->nr_poll_queues, num_online_cpus());
 
-	return ret;
+	return nr_io_queues;
 }
 
-static unsigned int i10_host_nr_io_queues(struct nvme_ctrl *ctrl)
+static void i10_host_set_io_queues(struct nvme_ctrl *nctrl,
+		unsigned int nr_io_queues)
 {
-	return min(ctrl->queue_count - 1, num_online_cpus());
+	struct i10_host_ctrl *ctrl = to_i10_host_ctrl(nctrl);
+	struct nvmf_ctrl_options *opts = nctrl->opts;
+
+	memset(ctrl->io_queues, 0, sizeof(ctrl->io_queues));
+
+	if (opts->nr_write_queues && opts->nr_io_queues < nr_io_queues) {
+		/* separate write and read queue sets */
+		ctrl->io_queues[I10_HOST_QUEUE_DEFAULT] =
+			min(opts->nr_write_queues, nr_io_queues);
+		nr_io_queues -= ctrl->io_queues[I10_HOST_QUEUE_DEFAULT];
+		ctrl->io_queues[I10_HOST_QUEUE_READ] =
+			min(opts->nr_io_queues, nr_io_queues);
+		nr_io_queues -= ctrl->io_queues[I10_HOST_QUEUE_READ];
+	} else {
+		/* reads and writes share the queues */
+		ctrl->io_queues[I10_HOST_QUEUE_DEFAULT] =
+			min(opts->nr_io_queues, nr_io_queues);
+		nr_io_queues -= ctrl->io_queues[I10_HOST_QUEUE_DEFAULT];
+	}
+
+	/* dedicated poll queues only if the controller gave us enough */
+	ctrl->io_queues[I10_HOST_QUEUE_POLL] =
+		min(opts->nr_poll_queues, nr_io_queues);
 }
 
 static int nvme_alloc_io_queues(struct nvme_ctrl *ctrl)
@@ -1978,13 +2735,13 @@ static int nvme_alloc_io_queues(struct nvme_ctrl *ctrl)
 
 	dev_info(ctrl->device,
 		"creating %d I/O queues.\n", nr_io_queues);
+	i10_host_set_io_queues(ctrl, nr_io_queues);
 
 	return i10_host_alloc_io_queues(ctrl);
 }
 
 static void i10_host_destroy_io_queues(struct nvme_ctrl *ctrl, bool remove)
 {
-	printk(KERN_INFO "i10_host_destroy_io_queues");        //123456
 	i10_host_stop_io_queues(ctrl);
 	if (remove) {
 		if (ctrl->ops->flags & NVME_F_FABRICS)
@@ -1997,7 +2754,7 @@ static void i10_host_destroy_io_queues(struct nvme_ctrl *ctrl, bool remove)
 static int i10_host_configure_io_queues(struct nvme_ctrl *ctrl, bool new)
 {
 	int ret;
-	printk(KERN_INFO "i10_host_configure_io_queues");        //123456
+
 	ret = nvme_alloc_io_queues(ctrl);
 	if (ret)
 		return ret;
@@ -2024,7 +2781,6 @@ static int i10_host_configure_io_queues(struct nvme_ctrl *ctrl, bool new)
 	ret = i10_host_start_io_queues(ctrl);
 	if (ret)
 		goto out_cleanup_connect_q;
-	printk(KERN_INFO "i10_host_configureioqueue  ok!!!");        //123456
 	return 0;
 
 out_cleanup_connect_q:
@@ -2040,7 +2796,6 @@ out_free_io_queues:
 
 static void i10_host_destroy_admin_queue(struct nvme_ctrl *ctrl, bool remove)
 {
-	printk(KERN_INFO "i10_host_destroy_admin_queue");        //123456
 	i10_host_stop_queue(ctrl, 0);
 	if (remove) {
 		free_opal_dev(ctrl->opal_dev);
@@ -2053,7 +2808,7 @@ static void i10_host_destroy_admin_queue(struct nvme_ctrl *ctrl, bool remove)
 static int i10_host_configure_admin_queue(struct nvme_ctrl *ctrl, bool new)
 {
 	int error;
-	printk(KERN_INFO "i10_host_configure_admin_queue");        //123456
+
 	error = i10_host_alloc_admin_queue(ctrl);
 	if (error)
 		return error;
@@ -2111,7 +2866,6 @@ out_free_queue:
 static void i10_host_teardown_admin_queue(struct nvme_ctrl *ctrl,
 		bool remove)
 {
-	printk(KERN_INFO "i10_host_teardown_admin_queue");        //123456
 	blk_mq_quiesce_queue(ctrl->admin_q);
 	i10_host_stop_queue(ctrl, 0);
 	blk_mq_tagset_busy_iter(ctrl->admin_tagset, nvme_cancel_request, ctrl);
@@ -2122,7 +2876,6 @@ static void i10_host_teardown_admin_queue(struct nvme_ctrl *ctrl,
 static void i10_host_teardown_io_queues(struct nvme_ctrl *ctrl,
 		bool remove)
 {
-	printk(KERN_INFO "i10_host_teardown_io_queues");        //123456
 	if (ctrl->queue_count <= 1)
 		return;
 	nvme_stop_queues(ctrl);
@@ -2141,7 +2894,6 @@ static void i10_host_reconnect_or_remove(struct nvme_ctrl *ctrl)
 			ctrl->state == NVME_CTRL_LIVE);
 		return;
 	}
-	printk(KERN_INFO "i10_host_reconnect_or_remove");        //123456
 	if (nvmf_should_reconnect(ctrl)) {
 		dev_info(ctrl->device, "Reconnecting in %d seconds...\n",
 			ctrl->opts->reconnect_delay);
@@ -2191,7 +2943,6 @@ static int i10_host_setup_ctrl(struct nvme_ctrl *ctrl, bool new)
 		ret = -EINVAL;
 		goto destroy_io;
 	}
-	printk(KERN_INFO "nvme_start_ctrl!!!");        //123456
 	nvme_start_ctrl(ctrl);
 	return 0;
 
@@ -2209,7 +2960,7 @@ static void i10_host_reconnect_ctrl_work(struct work_struct *work)
 	struct i10_host_ctrl *tcp_ctrl = container_of(to_delayed_work(work),
 			struct i10_host_ctrl, connect_work);
 	struct nvme_ctrl *ctrl = &tcp_ctrl->ctrl;
-	printk(KERN_INFO "i10_host_reconnect_ctrl_work");        //123456
+
 	++ctrl->nr_reconnects;
 
 	if (i10_host_setup_ctrl(ctrl, false))
@@ -2233,7 +2984,7 @@ static void i10_host_error_recovery_work(struct work_struct *work)
 	struct i10_host_ctrl *tcp_ctrl = container_of(work,
 				struct i10_host_ctrl, err_work);
 	struct nvme_ctrl *ctrl = &tcp_ctrl->ctrl;
-	printk(KERN_INFO "i10_host_error_recovery_work");        //123456
+
 	nvme_stop_keep_alive(ctrl);
 	i10_host_teardown_io_queues(ctrl, false);
 	/* unquiesce to fail fast pending requests */
@@ -2251,7 +3002,6 @@ static void i10_host_error_recovery_work(struct work_struct *work)
 
 static void i10_host_teardown_ctrl(struct nvme_ctrl *ctrl, bool shutdown)
 {
-	printk(KERN_INFO "i10_host_teardown_ctrl");        //123456
 	i10_host_teardown_io_queues(ctrl, shutdown);
 	if (shutdown)
 		nvme_shutdown_ctrl(ctrl);
@@ -2262,7 +3012,6 @@ static void i10_host_teardown_ctrl(struct nvme_ctrl *ctrl, bool shutdown)
 
 static void i10_host_delete_ctrl(struct nvme_ctrl *ctrl)
 {
-	printk(KERN_INFO "i10_host_delete_ctrl");        //123456
 	i10_host_teardown_ctrl(ctrl, true);
 }
 
@@ -2273,7 +3022,6 @@ static void nvme_reset_ctrl_work(struct work_struct *work)
 
 	nvme_stop_ctrl(ctrl);
 	i10_host_teardown_ctrl(ctrl, false);
-	printk(KERN_INFO "nvme_reset_ctrl_work");        //123456
 	if (!nvme_change_ctrl_state(ctrl, NVME_CTRL_CONNECTING)) {
 		/* state change failure is ok if we're in DELETING state */
 		WARN_ON_ONCE(ctrl->state != NVME_CTRL_DELETING);
@@ -2292,7 +3040,6 @@ out_fail:
 
 static void i10_host_stop_ctrl(struct nvme_ctrl *ctrl)
 {
-	printk(KERN_INFO "i10_host_stop_ctrl");        //123456
 	cancel_work_sync(&to_i10_host_ctrl(ctrl)->err_work);
 	cancel_delayed_work_sync(&to_i10_host_ctrl(ctrl)->connect_work);
 }
@@ -2303,13 +3050,13 @@ static void i10_host_free_ctrl(struct nvme_ctrl *nctrl)
 
 	if (list_empty(&ctrl->list))
 		goto free_ctrl;
-	printk(KERN_INFO "i10_host_free_ctrl");        //123456
 	mutex_lock(&i10_host_ctrl_mutex);
 	list_del(&ctrl->list);
 	mutex_unlock(&i10_host_ctrl_mutex);
 
 	nvmf_free_options(nctrl->opts);
 free_ctrl:
+	debugfs_remove_recursive(ctrl->debugfs_dir);
 	kfree(ctrl->queues);
 	kfree(ctrl);
 }
@@ -2317,7 +3064,7 @@ free_ctrl:
 static void i10_host_set_sg_null(struct nvme_command *c)
 {
 	struct nvme_sgl_desc *sg = &c->common.dptr.sgl;
-	printk(KERN_INFO "i10_host_set_sg_null");        //123456
+
 	sg->addr = 0;
 	sg->length = 0;
 	sg->type = (NVME_TRANSPORT_SGL_DATA_DESC << 4) |
@@ -2352,10 +3099,10 @@ static void i10_host_submit_async_event(struct nvme_ctrl *arg)
 	struct nvme_tcp_cmd_pdu *pdu = ctrl->async_req.pdu;
 	struct nvme_command *cmd = &pdu->cmd;
 	u8 hdgst = i10_host_hdgst_len(queue);
-	printk(KERN_INFO "i10_host_submit_async_event");        //123456
+
 	memset(pdu, 0, sizeof(*pdu));
 	pdu->hdr.type = nvme_tcp_cmd;
-	if (queue->hdr_digest)
+	if (i10_host_hdr_digest(queue))
 		pdu->hdr.flags |= NVME_TCP_F_HDGST;
 	pdu->hdr.hlen = sizeof(*pdu);
 	pdu->hdr.plen = cpu_to_le32(pdu->hdr.hlen + hdgst);
@@ -2366,11 +3113,13 @@ static void i10_host_submit_async_event(struct nvme_ctrl *arg)
 	i10_host_set_sg_null(cmd);
 
 	ctrl->async_req.state = I10_HOST_SEND_CMD_PDU;
+	ctrl->async_req.legacy = true;
 	ctrl->async_req.offset = 0;
 	ctrl->async_req.curr_bio = NULL;
 	ctrl->async_req.data_len = 0;
+	ctrl->async_req.lane = I10_HOST_LANE_SYNC;
 
-	i10_host_queue_request(&ctrl->async_req);
+	i10_host_queue_request(&ctrl->async_req, true);
 }
 
 static enum blk_eh_timer_return
@@ -2379,7 +3128,7 @@ i10_host_timeout(struct request *rq, bool reserved)
 	struct i10_host_request *req = blk_mq_rq_to_pdu(rq);
 	struct i10_host_ctrl *ctrl = req->queue->ctrl;
 	struct nvme_tcp_cmd_pdu *pdu = req->pdu;
-	printk(KERN_INFO "queue %d:timeout",i10_host_queue_id(req->queue));     //123
+
 	dev_dbg(ctrl->ctrl.device,
 		"queue %d: timeout request %#x type %d\n",
 		i10_host_queue_id(req->queue), rq->tag,
@@ -2425,7 +3174,7 @@ static blk_status_t i10_host_setup_cmd_pdu(struct nvme_ns *ns,
 	struct i10_host_queue *queue = req->queue;
 	u8 hdgst = i10_host_hdgst_len(queue), ddgst = 0;
 	blk_status_t ret;
-	printk(KERN_INFO "i10_host_setup_cmd_pdu");        //123456
+
 	ret = nvme_setup_cmd(ns, rq, &pdu->cmd);
 	if (ret)
 		return ret;
@@ -2435,8 +3184,12 @@ static blk_status_t i10_host_setup_cmd_pdu(struct nvme_ns *ns,
 	req->data_sent = 0;
 	req->pdu_len = 0;
 	req->pdu_sent = 0;
+	req->r2t_end = 0;
 	req->data_len = blk_rq_payload_bytes(rq);
 	req->curr_bio = rq->bio;
+	req->start_ns = 0;
+	req->lane = i10_host_req_lane(req);
+	req->legacy = i10_host_legacy_path(req);
 
 	if (rq_data_dir(rq) == WRITE &&
 	    req->data_len <= i10_host_inline_data_size(queue))
@@ -2446,9 +3199,9 @@ static blk_status_t i10_host_setup_cmd_pdu(struct nvme_ns *ns,
 
 	pdu->hdr.type = nvme_tcp_cmd;
 	pdu->hdr.flags = 0;
-	if (queue->hdr_digest)
+	if (i10_host_hdr_digest(queue))
 		pdu->hdr.flags |= NVME_TCP_F_HDGST;
-	if (queue->data_digest && req->pdu_len) {
+	if (i10_host_data_digest(queue) && req->pdu_len) {
 		pdu->hdr.flags |= NVME_TCP_F_DDGST;
 		ddgst = i10_host_ddgst_len(queue);
 	}
@@ -2484,19 +3237,86 @@ static blk_status_t i10_host_queue_rq(struct blk_mq_hw_ctx *hctx,
 	if (unlikely(ret))
 		return ret;
 
+	nvme_mpath_start_request(rq);
 	blk_mq_start_request(rq);
+	trace_i10_host_queue_rq(queue->ctrl->ctrl.instance,
+		i10_host_queue_id(queue), rq->tag,
+		i10_host_req_caravan(req)->profile->name, req->data_len,
+		bd->last);
 
-	i10_host_queue_request(req);
+	i10_host_queue_request(req, bd->last);
 
 	return BLK_STS_OK;
 }
 
+static int i10_host_rq_flags_to_type(struct request_queue *q,
+		unsigned int flags)
+{
+	if ((flags & REQ_HIPRI) && test_bit(QUEUE_FLAG_POLL, &q->queue_flags))
+		return I10_HOST_QUEUE_POLL;
+	if ((flags & REQ_OP_MASK) == REQ_OP_READ)
+		return I10_HOST_QUEUE_READ;
+
+	return I10_HOST_QUEUE_DEFAULT;
+}
+
+static int i10_host_map_queues(struct blk_mq_tag_set *set)
+{
+	struct i10_host_ctrl *ctrl = set->driver_data;
+	int i, qoff;
+
+	for (i = 0, qoff = 0; i < set->nr_maps; i++) {
+		struct blk_mq_queue_map *map = &set->map[i];
+
+		map->nr_queues = ctrl->io_queues[i];
+		if (!map->nr_queues) {
+			BUG_ON(i == I10_HOST_QUEUE_DEFAULT);
+
+			/* no read or poll queues, share the default set */
+			map->nr_queues = ctrl->io_queues[I10_HOST_QUEUE_DEFAULT];
+			qoff = 0;
+		}
+
+		map->queue_offset = qoff;
+		blk_mq_map_queues(map);
+		qoff += map->nr_queues;
+	}
+
+	return 0;
+}
+
+/*
+ * Reap completions from the submitting context.  Hipri bios are not in
+ * I10_ALLOWED_FLAGS, so they already take the no-delay lane on send and
+ * the doorbell never holds them back.
+ */
+static int i10_host_poll(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	struct i10_host_queue *queue = hctx->driver_data;
+	struct sock *sk = queue->sock->sk;
+
+	if (!test_bit(I10_HOST_Q_LIVE, &queue->flags))
+		return 0;
+
+	set_bit(I10_HOST_Q_POLLING, &queue->flags);
+	queue->nr_cqe = 0;
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue))
+		sk_busy_loop(sk, true);
+	i10_host_try_recv(queue);
+	clear_bit(I10_HOST_Q_POLLING, &queue->flags);
+
+	return queue->nr_cqe;
+}
+
 static struct blk_mq_ops i10_host_mq_ops = {
 	.queue_rq	= i10_host_queue_rq,
+	.rq_flags_to_type = i10_host_rq_flags_to_type,
 	.complete	= nvme_complete_rq,
 	.init_request	= i10_host_init_request,
 	.exit_request	= i10_host_exit_request,
 	.init_hctx	= i10_host_init_hctx,
+	.map_queues	= i10_host_map_queues,
+	.poll		= i10_host_poll,
 	.timeout	= i10_host_timeout,
 };
 
@@ -2509,6 +3329,117 @@ static struct blk_mq_ops i10_host_admin_mq_ops = {
 	.timeout	= i10_host_timeout,
 };
 
+static const char * const i10_host_doorbell_policy_names[] = {
+	[I10_HOST_DOORBELL_STATIC]	= "static",
+	[I10_HOST_DOORBELL_LATENCY]	= "latency",
+	[I10_HOST_DOORBELL_THROUGHPUT]	= "throughput",
+};
+
+static void i10_host_show_doorbell(struct seq_file *m, const char *name,
+		struct i10_host_doorbell *db)
+{
+	seq_printf(m, "%s: delay_us %d batch %d gap_ns %llu lat_ns %llu\n",
+		name, READ_ONCE(db->delay_us), READ_ONCE(db->batch),
+		READ_ONCE(db->gap_ns), READ_ONCE(db->lat_ns));
+}
+
+static int i10_host_doorbell_show(struct seq_file *m, void *unused)
+{
+	struct i10_host_queue *queue = m->private;
+	int policy = READ_ONCE(i10_doorbell_policy);
+	int i;
+
+	if (!test_bit(I10_HOST_Q_ALLOCATED, &queue->flags)) {
+		seq_puts(m, "not allocated\n");
+		return 0;
+	}
+
+	seq_printf(m, "policy: %s\n",
+		(policy >= 0 &&
+		 policy < ARRAY_SIZE(i10_host_doorbell_policy_names)) ?
+			i10_host_doorbell_policy_names[policy] : "static");
+	for (i = 0; i < I10_HOST_NR_LANES; i++)
+		i10_host_show_doorbell(m, i10_host_lanes[i].name,
+				&queue->caravans[i].doorbell);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(i10_host_doorbell);
+
+static void i10_host_show_hist(struct seq_file *m, const char *name,
+		const u64 *hist, unsigned int shift)
+{
+	int i;
+
+	seq_printf(m, "  %s:", name);
+	for (i = 0; i < I10_HOST_STATS_BUCKETS; i++)
+		seq_printf(m, " %lu:%llu", i ? 1UL << (i + shift) : 0,
+			READ_ONCE(hist[i]));
+	seq_putc(m, '\n');
+}
+
+static int i10_host_stats_show(struct seq_file *m, void *unused)
+{
+	struct i10_host_queue *queue = m->private;
+	int i, j;
+
+	if (!test_bit(I10_HOST_Q_ALLOCATED, &queue->flags)) {
+		seq_puts(m, "not allocated\n");
+		return 0;
+	}
+
+	for (i = 0; i < I10_HOST_NR_LANES; i++) {
+		struct i10_host_caravan_stats *stats =
+			&queue->caravans[i].stats;
+		u64 nr = 0;
+
+		seq_printf(m, "%s:\n  flushes:", i10_host_lanes[i].name);
+		for (j = 0; j < I10_HOST_NR_FLUSH_REASONS; j++) {
+			nr += READ_ONCE(stats->flushes[j]);
+			seq_printf(m, " %s %llu", i10_host_flush_reason_names[j],
+				READ_ONCE(stats->flushes[j]));
+		}
+		seq_printf(m, "\n  timer_fires %llu early_rings %llu nospace %llu staged %llu\n",
+			READ_ONCE(stats->timer_fires),
+			READ_ONCE(stats->early_rings),
+			READ_ONCE(stats->nospace),
+			READ_ONCE(stats->staged));
+		seq_printf(m, "  flush_lat_ns avg %llu max %llu\n",
+			nr ? div64_u64(READ_ONCE(stats->flush_lat_ns), nr) : 0,
+			READ_ONCE(stats->flush_lat_max_ns));
+		i10_host_show_hist(m, "bytes", stats->bytes,
+			I10_HOST_STATS_BYTES_SHIFT);
+		i10_host_show_hist(m, "iovs", stats->iovs, 0);
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(i10_host_stats);
+
+static void i10_host_debugfs_init_ctrl(struct i10_host_ctrl *ctrl)
+{
+	char name[16];
+	int i;
+
+	if (IS_ERR_OR_NULL(i10_host_debugfs_root))
+		return;
+
+	ctrl->debugfs_dir = debugfs_create_dir(dev_name(ctrl->ctrl.device),
+				i10_host_debugfs_root);
+	if (IS_ERR_OR_NULL(ctrl->debugfs_dir))
+		return;
+
+	for (i = 0; i < ctrl->ctrl.queue_count; i++) {
+		struct i10_host_queue *queue = &ctrl->queues[i];
+
+		snprintf(name, sizeof(name), "queue%d", i);
+		queue->debugfs_dir = debugfs_create_dir(name,
+					ctrl->debugfs_dir);
+		debugfs_create_file("doorbell", 0444, queue->debugfs_dir,
+				queue, &i10_host_doorbell_fops);
+		debugfs_create_file("stats", 0444, queue->debugfs_dir,
+				queue, &i10_host_stats_fops);
+	}
+}
+
 static const struct nvme_ctrl_ops i10_host_ctrl_ops = {
 	.name			= "i10",
 	.module			= THIS_MODULE,
@@ -2551,8 +3482,10 @@ static struct nvme_ctrl *i10_host_create_ctrl(struct device *dev,
 		return ERR_PTR(-ENOMEM);
 
 	INIT_LIST_HEAD(&ctrl->list);
+	spin_lock_init(&ctrl->io_cpu_lock);
 	ctrl->ctrl.opts = opts;
-	ctrl->ctrl.queue_count = opts->nr_io_queues + 1; /* +1 for admin queue */
+	ctrl->ctrl.queue_count = opts->nr_io_queues + opts->nr_write_queues +
+				 opts->nr_poll_queues + 1;
 	ctrl->ctrl.sqsize = opts->queue_size - 1;
 	ctrl->ctrl.kato = opts->kato;
 
@@ -2594,7 +3527,7 @@ static struct nvme_ctrl *i10_host_create_ctrl(struct device *dev,
 		goto out_free_ctrl;
 	}
 
-	ctrl->queues = kcalloc(opts->nr_io_queues + 1, sizeof(*ctrl->queues),
+	ctrl->queues = kcalloc(ctrl->ctrl.queue_count, sizeof(*ctrl->queues),
 				GFP_KERNEL);
 	if (!ctrl->queues) {
 		ret = -ENOMEM;
@@ -2605,6 +3538,8 @@ static struct nvme_ctrl *i10_host_create_ctrl(struct device *dev,
 	if (ret)
 		goto out_kfree_queues;
 
+	i10_host_debugfs_init_ctrl(ctrl);
+
 	if (!nvme_change_ctrl_state(&ctrl->ctrl, NVME_CTRL_CONNECTING)) {
 		WARN_ON_ONCE(1);
 		ret = -EINTR;
@@ -2645,7 +3580,9 @@ static struct nvmf_transport_ops i10_host_transport = {
 	.required_opts	= NVMF_OPT_TRADDR,
 	.allowed_opts	= NVMF_OPT_TRSVCID | NVMF_OPT_RECONNECT_DELAY |
 			  NVMF_OPT_HOST_TRADDR | NVMF_OPT_CTRL_LOSS_TMO |
-			  NVMF_OPT_HDR_DIGEST | NVMF_OPT_DATA_DIGEST,
+			  NVMF_OPT_HDR_DIGEST | NVMF_OPT_DATA_DIGEST |
+			  NVMF_OPT_ZERO_COPY | NVMF_OPT_NR_POLL_QUEUES |
+			  NVMF_OPT_IO_CPUS | NVMF_OPT_NR_WRITE_QUEUES,
 	.create_ctrl	= i10_host_create_ctrl,
 };
 
@@ -2656,6 +3593,8 @@ static int __init i10_host_init_module(void)
 	if (!i10_host_wq)
 		return -ENOMEM;
 
+	i10_host_debugfs_root = debugfs_create_dir("i10_host", NULL);
+
 	nvmf_register_transport(&i10_host_transport);
 	return 0;
 }
@@ -2663,20 +3602,15 @@ static int __init i10_host_init_module(void)
 static void __exit i10_host_cleanup_module(void)
 {
 	struct i10_host_ctrl *ctrl;
-	printk(KERN_INFO "1");        //123
+
 	nvmf_unregister_transport(&i10_host_transport);
-	printk(KERN_INFO "2");        //123
 	mutex_lock(&i10_host_ctrl_mutex);
-	printk(KERN_INFO "3");        //123
 	list_for_each_entry(ctrl, &i10_host_ctrl_list, list)
 		nvme_delete_ctrl(&ctrl->ctrl);
-	printk(KERN_INFO "4");        //123
 	mutex_unlock(&i10_host_ctrl_mutex);
-	printk(KERN_INFO "5");        //123
 	flush_workqueue(nvme_delete_wq);
-	printk(KERN_INFO "6");        //123
 	destroy_workqueue(i10_host_wq);
-	printk(KERN_INFO "7");        //123
+	debugfs_remove_recursive(i10_host_debugfs_root);
 }
 
 module_init(i10_host_init_module);
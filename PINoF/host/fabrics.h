@@ -61,6 +61,10 @@ enum {
 	NVMF_OPT_DISABLE_SQFLOW = 1 << 14,
 	NVMF_OPT_HDR_DIGEST	= 1 << 15,
 	NVMF_OPT_DATA_DIGEST	= 1 << 16,
+	NVMF_OPT_ZERO_COPY	= 1 << 17,
+	NVMF_OPT_NR_POLL_QUEUES	= 1 << 18,
+	NVMF_OPT_IO_CPUS	= 1 << 19,
+	NVMF_OPT_NR_WRITE_QUEUES = 1 << 20,
 };
 
 /**
@@ -88,6 +92,12 @@ enum {
  * @max_reconnects: maximum number of allowed reconnect attempts before removing
  *              the controller, (-1) means reconnect forever, zero means remove
  *              immediately;
+ * @zero_copy:	Send I/O data by page reference instead of copying it.
+ * @nr_poll_queues: Number of additional IO queues for polled (hipri) IO.
+ * @io_cpus:	CPUs to run the IO queues on; empty selects automatically.
+ *		Given as a cpulist with ':' between groups, e.g. 0-3:8-11.
+ * @nr_write_queues: Number of IO queues for writes and other non-read IO;
+ *		the @nr_io_queues queues then carry reads only.
  */
 struct nvmf_ctrl_options {
 	unsigned		mask;
@@ -107,6 +117,10 @@ struct nvmf_ctrl_options {
 	bool			disable_sqflow;
 	bool			hdr_digest;
 	bool			data_digest;
+	bool			zero_copy;
+	unsigned int		nr_poll_queues;
+	struct cpumask		io_cpus;
+	unsigned int		nr_write_queues;
 };
 
 /*
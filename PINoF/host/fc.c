@@ -2242,8 +2242,10 @@ nvme_fc_start_fcp_op(struct nvme_fc_ctrl *ctrl, struct nvme_fc_queue *queue,
 
 	atomic_set(&op->state, FCPOP_STATE_ACTIVE);
 
-	if (!(op->flags & FCOP_FLAGS_AEN))
+	if (!(op->flags & FCOP_FLAGS_AEN)) {
+		nvme_mpath_start_request(op->rq);
 		blk_mq_start_request(op->rq);
+	}
 
 	ret = ctrl->lport->ops->fcp_io(&ctrl->lport->localport,
 					&ctrl->rport->remoteport,
@@ -0,0 +1,132 @@
+/*
+ * i10 host transport tracepoints
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM i10_host
+
+#if !defined(_TRACE_I10_HOST_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_I10_HOST_H
+
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+
+/*
+ * Every event carries the controller instance and the queue id, and the
+ * per-request ones the command id, so that they can be joined with each
+ * other and with nvme:nvme_complete_rq.  See tools/i10_host_lat.bt.
+ */
+
+TRACE_EVENT(i10_host_queue_rq,
+	TP_PROTO(int ctrl_id, int qid, int cid, const char *lane,
+		u32 data_len, bool last),
+	TP_ARGS(ctrl_id, qid, cid, lane, data_len, last),
+	TP_STRUCT__entry(
+		__field(int, ctrl_id)
+		__field(int, qid)
+		__field(int, cid)
+		__string(lane, lane)
+		__field(u32, data_len)
+		__field(bool, last)
+	),
+	TP_fast_assign(
+		__entry->ctrl_id = ctrl_id;
+		__entry->qid = qid;
+		__entry->cid = cid;
+		__assign_str(lane, lane);
+		__entry->data_len = data_len;
+		__entry->last = last;
+	),
+	TP_printk("nvme%d: qid=%d, cmdid=%u, lane=%s, len=%u, last=%d",
+		__entry->ctrl_id, __entry->qid, __entry->cid, __get_str(lane),
+		__entry->data_len, __entry->last)
+);
+
+DECLARE_EVENT_CLASS(i10_host_doorbell,
+	TP_PROTO(int ctrl_id, int qid, const char *lane, int nr_req,
+		int delay_us),
+	TP_ARGS(ctrl_id, qid, lane, nr_req, delay_us),
+	TP_STRUCT__entry(
+		__field(int, ctrl_id)
+		__field(int, qid)
+		__string(lane, lane)
+		__field(int, nr_req)
+		__field(int, delay_us)
+	),
+	TP_fast_assign(
+		__entry->ctrl_id = ctrl_id;
+		__entry->qid = qid;
+		__assign_str(lane, lane);
+		__entry->nr_req = nr_req;
+		__entry->delay_us = delay_us;
+	),
+	TP_printk("nvme%d: qid=%d, lane=%s, nr_req=%d, delay_us=%d",
+		__entry->ctrl_id, __entry->qid, __get_str(lane),
+		__entry->nr_req, __entry->delay_us)
+);
+
+DEFINE_EVENT(i10_host_doorbell, i10_host_doorbell_armed,
+	TP_PROTO(int ctrl_id, int qid, const char *lane, int nr_req,
+		int delay_us),
+	TP_ARGS(ctrl_id, qid, lane, nr_req, delay_us)
+);
+
+DEFINE_EVENT(i10_host_doorbell, i10_host_doorbell_fired,
+	TP_PROTO(int ctrl_id, int qid, const char *lane, int nr_req,
+		int delay_us),
+	TP_ARGS(ctrl_id, qid, lane, nr_req, delay_us)
+);
+
+DEFINE_EVENT(i10_host_doorbell, i10_host_doorbell_cancelled,
+	TP_PROTO(int ctrl_id, int qid, const char *lane, int nr_req,
+		int delay_us),
+	TP_ARGS(ctrl_id, qid, lane, nr_req, delay_us)
+);
+
+TRACE_EVENT(i10_host_caravan_flush,
+	TP_PROTO(int ctrl_id, int qid, const char *lane, size_t bytes,
+		int iovs, const char *reason, u64 first_ns),
+	TP_ARGS(ctrl_id, qid, lane, bytes, iovs, reason, first_ns),
+	TP_STRUCT__entry(
+		__field(int, ctrl_id)
+		__field(int, qid)
+		__string(lane, lane)
+		__field(size_t, bytes)
+		__field(int, iovs)
+		__string(reason, reason)
+		__field(u64, wait_ns)
+	),
+	TP_fast_assign(
+		__entry->ctrl_id = ctrl_id;
+		__entry->qid = qid;
+		__assign_str(lane, lane);
+		__entry->bytes = bytes;
+		__entry->iovs = iovs;
+		__assign_str(reason, reason);
+		/* only read the clock when the event is enabled */
+		__entry->wait_ns = ktime_get_ns() - first_ns;
+	),
+	TP_printk("nvme%d: qid=%d, lane=%s, bytes=%zu, iovs=%d, reason=%s, wait_ns=%llu",
+		__entry->ctrl_id, __entry->qid, __get_str(lane),
+		__entry->bytes, __entry->iovs, __get_str(reason),
+		__entry->wait_ns)
+);
+
+#endif /* _TRACE_I10_HOST_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE i10_trace
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
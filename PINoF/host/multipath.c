@@ -20,6 +20,48 @@ module_param(multipath, bool, 0444);
 MODULE_PARM_DESC(multipath,
 	"turn on native support for multiple controllers per subsystem");
 
+static const char *nvme_iopolicy_names[] = {
+	[NVME_IOPOLICY_NUMA]	= "numa",
+	[NVME_IOPOLICY_RR]	= "round-robin",
+	[NVME_IOPOLICY_QD]	= "queue-depth",
+	[NVME_IOPOLICY_LAT]	= "latency",
+};
+
+static int iopolicy = NVME_IOPOLICY_NUMA;
+
+static int nvme_set_iopolicy(const char *val, const struct kernel_param *kp)
+{
+	int i;
+
+	if (!val)
+		return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(nvme_iopolicy_names); i++) {
+		if (sysfs_streq(val, nvme_iopolicy_names[i])) {
+			iopolicy = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int nvme_get_iopolicy(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%s\n", nvme_iopolicy_names[iopolicy]);
+}
+
+module_param_call(iopolicy, nvme_set_iopolicy, nvme_get_iopolicy,
+	&iopolicy, 0644);
+MODULE_PARM_DESC(iopolicy,
+	"Default multipath I/O policy; 'numa' (default), 'round-robin', 'queue-depth' or 'latency'");
+
+/* EWMA weight (1/8) of the per-controller completion latency */
+#define NVME_MPATH_LAT_EWMA_SHIFT	3
+
+void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys)
+{
+	subsys->iopolicy = iopolicy;
+}
+
 inline bool nvme_ctrl_use_ana(struct nvme_ctrl *ctrl)
 {
 	return multipath && ctrl->subsys && (ctrl->subsys->cmic & (1 << 3));
@@ -174,17 +216,163 @@ static inline bool nvme_path_is_optimized(struct nvme_ns *ns)
 		ns->ana_state == NVME_ANA_OPTIMIZED;
 }
 
+static inline bool nvme_path_is_disabled(struct nvme_ns *ns)
+{
+	return ns->ctrl->state != NVME_CTRL_LIVE ||
+		test_bit(NVME_NS_ANA_PENDING, &ns->flags);
+}
+
+static struct nvme_ns *nvme_next_ns(struct nvme_ns_head *head,
+		struct nvme_ns *ns)
+{
+	ns = list_next_or_null_rcu(&head->list, &ns->siblings, struct nvme_ns,
+			siblings);
+	if (ns)
+		return ns;
+	return list_first_or_null_rcu(&head->list, struct nvme_ns, siblings);
+}
+
+/*
+ * Take the next usable path after @old, preferring optimized ones.  The
+ * chosen path becomes the current one of @node so that polling follows.
+ */
+static struct nvme_ns *nvme_round_robin_path(struct nvme_ns_head *head,
+		int node, struct nvme_ns *old)
+{
+	struct nvme_ns *ns, *found = NULL;
+
+	for (ns = nvme_next_ns(head, old);
+	     ns && ns != old;
+	     ns = nvme_next_ns(head, ns)) {
+		if (nvme_path_is_disabled(ns))
+			continue;
+
+		if (ns->ana_state == NVME_ANA_OPTIMIZED) {
+			found = ns;
+			goto out;
+		}
+		if (ns->ana_state == NVME_ANA_NONOPTIMIZED && !found)
+			found = ns;
+	}
+
+	if (!nvme_path_is_disabled(old) &&
+	    (old->ana_state == NVME_ANA_OPTIMIZED ||
+	     (!found && old->ana_state == NVME_ANA_NONOPTIMIZED)))
+		return old;
+	if (!found)
+		return NULL;
+out:
+	rcu_assign_pointer(head->current_path[node], found);
+	return found;
+}
+
+/* Lower is better, for the queue-depth and latency policies */
+static inline u64 nvme_path_cost(struct nvme_ns *ns, enum nvme_iopolicy policy)
+{
+	u64 depth = atomic_read(&ns->ctrl->nr_active);
+
+	if (policy == NVME_IOPOLICY_QD)
+		return depth;
+	/* expected time until a new request completes on this path */
+	return (depth + 1) * READ_ONCE(ns->ctrl->mpath_lat_ns);
+}
+
+/*
+ * Take the cheapest usable path; non-optimized paths only count when no
+ * optimized one is usable, so ANA state still decides first.
+ */
+static struct nvme_ns *nvme_least_cost_path(struct nvme_ns_head *head,
+		int node, enum nvme_iopolicy policy)
+{
+	u64 found_cost = U64_MAX, fallback_cost = U64_MAX, cost;
+	struct nvme_ns *found = NULL, *fallback = NULL, *ns;
+
+	list_for_each_entry_rcu(ns, &head->list, siblings) {
+		if (nvme_path_is_disabled(ns))
+			continue;
+
+		cost = nvme_path_cost(ns, policy);
+		switch (ns->ana_state) {
+		case NVME_ANA_OPTIMIZED:
+			if (cost < found_cost) {
+				found_cost = cost;
+				found = ns;
+			}
+			break;
+		case NVME_ANA_NONOPTIMIZED:
+			if (cost < fallback_cost) {
+				fallback_cost = cost;
+				fallback = ns;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (!found)
+		found = fallback;
+	if (found && found != rcu_access_pointer(head->current_path[node]))
+		rcu_assign_pointer(head->current_path[node], found);
+	return found;
+}
+
 inline struct nvme_ns *nvme_find_path(struct nvme_ns_head *head)
 {
+	enum nvme_iopolicy policy = READ_ONCE(head->subsys->iopolicy);
 	int node = numa_node_id();
 	struct nvme_ns *ns;
 
 	ns = srcu_dereference(head->current_path[node], &head->srcu);
+	switch (policy) {
+	case NVME_IOPOLICY_RR:
+		if (likely(ns) && !list_is_singular(&head->list))
+			return nvme_round_robin_path(head, node, ns);
+		break;
+	case NVME_IOPOLICY_QD:
+	case NVME_IOPOLICY_LAT:
+		if (!list_is_singular(&head->list))
+			return nvme_least_cost_path(head, node, policy);
+		break;
+	default:
+		break;
+	}
+
 	if (unlikely(!ns || !nvme_path_is_optimized(ns)))
 		ns = __nvme_find_path(head, node);
 	return ns;
 }
 
+void __nvme_mpath_start_request(struct request *rq)
+{
+	struct nvme_ns *ns = rq->q->queuedata;
+
+	if (READ_ONCE(ns->head->subsys->iopolicy) < NVME_IOPOLICY_QD)
+		return;
+
+	atomic_inc(&ns->ctrl->nr_active);
+	nvme_req(rq)->flags |= NVME_MPATH_IO_STATS;
+	nvme_req(rq)->start_ns = ktime_get_ns();
+}
+EXPORT_SYMBOL_GPL(__nvme_mpath_start_request);
+
+void __nvme_mpath_end_request(struct request *rq)
+{
+	struct nvme_ctrl *ctrl = nvme_req(rq)->ctrl;
+	u64 lat = ktime_get_ns() - nvme_req(rq)->start_ns;
+	u64 ewma = READ_ONCE(ctrl->mpath_lat_ns);
+
+	/* racy against other completions, which only blurs the average */
+	if (ewma)
+		ewma += (s64)(lat - ewma) >> NVME_MPATH_LAT_EWMA_SHIFT;
+	else
+		ewma = lat;
+	WRITE_ONCE(ctrl->mpath_lat_ns, ewma);
+
+	atomic_dec(&ctrl->nr_active);
+	nvme_req(rq)->flags &= ~NVME_MPATH_IO_STATS;
+}
+
 static blk_qc_t nvme_ns_head_make_request(struct request_queue *q,
 		struct bio *bio)
 {
@@ -487,6 +675,36 @@ void nvme_mpath_stop(struct nvme_ctrl *ctrl)
 	cancel_work_sync(&ctrl->ana_work);
 }
 
+static ssize_t nvme_subsys_iopolicy_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct nvme_subsystem *subsys =
+		container_of(dev, struct nvme_subsystem, dev);
+
+	return sprintf(buf, "%s\n",
+			nvme_iopolicy_names[READ_ONCE(subsys->iopolicy)]);
+}
+
+static ssize_t nvme_subsys_iopolicy_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct nvme_subsystem *subsys =
+		container_of(dev, struct nvme_subsystem, dev);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(nvme_iopolicy_names); i++) {
+		if (sysfs_streq(buf, nvme_iopolicy_names[i])) {
+			WRITE_ONCE(subsys->iopolicy, i);
+			return count;
+		}
+	}
+
+	return -EINVAL;
+}
+struct device_attribute subsys_attr_iopolicy =
+	__ATTR(iopolicy, S_IRUGO | S_IWUSR,
+	       nvme_subsys_iopolicy_show, nvme_subsys_iopolicy_store);
+
 static ssize_t ana_grpid_show(struct device *dev, struct device_attribute *attr,
 		char *buf)
 {
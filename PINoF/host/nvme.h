@@ -103,6 +103,7 @@ struct nvme_request {
 	u8			flags;
 	u16			status;
 	struct nvme_ctrl	*ctrl;
+	u64			start_ns;	/* for the mpath iopolicy */
 };
 
 /*
@@ -113,6 +114,7 @@ struct nvme_request {
 enum {
 	NVME_REQ_CANCELLED		= (1 << 0),
 	NVME_REQ_USERCMD		= (1 << 1),
+	NVME_MPATH_IO_STATS		= (1 << 2),
 };
 
 static inline struct nvme_request *nvme_req(struct request *req)
@@ -221,6 +223,10 @@ struct nvme_ctrl {
 	size_t ana_log_size;
 	struct timer_list anatt_timer;
 	struct work_struct ana_work;
+
+	/* path load, for the queue-depth and latency iopolicies */
+	atomic_t nr_active;
+	u64 mpath_lat_ns;	/* EWMA of the completion latency */
 #endif
 
 	/* Power saving configuration */
@@ -243,6 +249,17 @@ struct nvme_ctrl {
 	struct nvmf_ctrl_options *opts;
 };
 
+/*
+ * How the multipath node spreads I/O over the optimized paths of a
+ * namespace, see nvme_find_path().
+ */
+enum nvme_iopolicy {
+	NVME_IOPOLICY_NUMA,	/* closest path, cached per node */
+	NVME_IOPOLICY_RR,	/* round-robin */
+	NVME_IOPOLICY_QD,	/* fewest requests in flight */
+	NVME_IOPOLICY_LAT,	/* lowest expected (EWMA) latency */
+};
+
 struct nvme_subsystem {
 	int			instance;
 	struct device		dev;
@@ -262,6 +279,9 @@ struct nvme_subsystem {
 	u8			cmic;
 	u16			vendor_id;
 	struct ida		ns_ida;
+#ifdef CONFIG_NVME_MULTIPATH
+	enum nvme_iopolicy	iopolicy;
+#endif
 };
 
 /*
@@ -481,6 +501,22 @@ void nvme_mpath_uninit(struct nvme_ctrl *ctrl);
 void nvme_mpath_stop(struct nvme_ctrl *ctrl);
 void nvme_mpath_clear_current_path(struct nvme_ns *ns);
 struct nvme_ns *nvme_find_path(struct nvme_ns_head *head);
+void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys);
+void __nvme_mpath_start_request(struct request *rq);
+void __nvme_mpath_end_request(struct request *rq);
+
+/* Called by the transports right before blk_mq_start_request() */
+static inline void nvme_mpath_start_request(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_NVME_MPATH)
+		__nvme_mpath_start_request(rq);
+}
+
+static inline void nvme_mpath_end_request(struct request *rq)
+{
+	if (nvme_req(rq)->flags & NVME_MPATH_IO_STATS)
+		__nvme_mpath_end_request(rq);
+}
 
 static inline void nvme_mpath_check_last_path(struct nvme_ns *ns)
 {
@@ -492,6 +528,7 @@ static inline void nvme_mpath_check_last_path(struct nvme_ns *ns)
 
 extern struct device_attribute dev_attr_ana_grpid;
 extern struct device_attribute dev_attr_ana_state;
+extern struct device_attribute subsys_attr_iopolicy;
 
 #else
 static inline bool nvme_ctrl_use_ana(struct nvme_ctrl *ctrl)
@@ -543,6 +580,15 @@ static inline void nvme_mpath_uninit(struct nvme_ctrl *ctrl)
 static inline void nvme_mpath_stop(struct nvme_ctrl *ctrl)
 {
 }
+static inline void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys)
+{
+}
+static inline void nvme_mpath_start_request(struct request *rq)
+{
+}
+static inline void nvme_mpath_end_request(struct request *rq)
+{
+}
 #endif /* CONFIG_NVME_MULTIPATH */
 
 #ifdef CONFIG_NVM
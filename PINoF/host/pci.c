@@ -922,6 +922,7 @@ static blk_status_t nvme_queue_rq(struct blk_mq_hw_ctx *hctx,
 			goto out_cleanup_iod;
 	}
 
+	nvme_mpath_start_request(req);
 	blk_mq_start_request(req);
 	nvme_submit_cmd(nvmeq, &cmnd);
 	return BLK_STS_OK;
@@ -1719,6 +1719,7 @@ static blk_status_t nvme_rdma_queue_rq(struct blk_mq_hw_ctx *hctx,
 	if (ret)
 		return ret;
 
+	nvme_mpath_start_request(rq);
 	blk_mq_start_request(rq);
 
 	err = nvme_rdma_map_data(queue, rq, c);
@@ -2045,6 +2045,7 @@ static blk_status_t nvme_tcp_queue_rq(struct blk_mq_hw_ctx *hctx,
 	if (unlikely(ret))
 		return ret;
 
+	nvme_mpath_start_request(rq);
 	blk_mq_start_request(rq);
 
 	nvme_tcp_queue_request(req);
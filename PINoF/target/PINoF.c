@@ -20,19 +20,78 @@
 #include <linux/nvme-tcp.h>
 #include <net/sock.h>
 #include <net/tcp.h>
+#include <net/busy_poll.h>
 #include <linux/inet.h>
 #include <linux/llist.h>
-#include <crypto/hash.h>
+#include <linux/jump_label.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/blkdev.h>
+#include <linux/crc32.h>
+#include <linux/crc32c.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/pci.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "nvmet.h"
 
+#define CREATE_TRACE_POINTS
+#include "i10_trace.h"
+
 #define I10_TARGET_DEF_INLINE_DATA_SIZE	(4 * PAGE_SIZE)
+/* Large enough that writes up to 128K skip the R2T round trip */
+#define I10_TARGET_MAX_INLINE_DATA_SIZE	max_t(int, SZ_128K, PAGE_SIZE)
 
 #define I10_CARAVAN_CAPACITY		65536
 #define I10_CARAVAN2_CAPACITY		256
 #define I10_TARGET_RECV_BUDGET		16
 #define I10_TARGET_SEND_BUDGET		16
 #define I10_TARGET_IO_WORK_BUDGET	64
+#define I10_CARAVAN_STAGE_MAX		SZ_64K
+#define I10_TARGET_SHRINK_INTERVAL	(5 * HZ)
+#define I10_TARGET_CMDS_RESERVE		I10_TARGET_RECV_BUDGET
+
+static int i10_pool_cmd_pages = 32;
+module_param(i10_pool_cmd_pages, int, 0444);
+MODULE_PARM_DESC(i10_pool_cmd_pages,
+	"data pages pooled per command slot, 0 disables the pool");
+
+static int i10_target_sockbuf_size;
+module_param(i10_target_sockbuf_size, int, 0644);
+MODULE_PARM_DESC(i10_target_sockbuf_size,
+	"fixed sndbuf/rcvbuf of ports added from then on, 0 lets TCP autotune");
+
+static int i10_pool_max_pages = 256;
+module_param(i10_pool_max_pages, int, 0444);
+MODULE_PARM_DESC(i10_pool_max_pages,
+	"data pages pooled per queue at most (default 256, 1M with 4K pages)");
+
+static int i10_target_delayed_doorbell_us = 25;
+module_param(i10_target_delayed_doorbell_us, int, 0644);
+MODULE_PARM_DESC(i10_target_delayed_doorbell_us,
+	"delayed doorbell timeout of the data lane in us, 0 sends at once");
+
+static int i10_target_doorbell_batch = I10_TARGET_SEND_BUDGET;
+module_param(i10_target_doorbell_batch, int, 0644);
+MODULE_PARM_DESC(i10_target_doorbell_batch,
+	"commands that ring a delayed doorbell before its timeout");
+
+static bool i10_target_exec_merge = true;
+module_param(i10_target_exec_merge, bool, 0644);
+MODULE_PARM_DESC(i10_target_exec_merge,
+	"submit the reads/writes of a receive round in LBA order");
+
+static int i10_target_poll_idle_us = 50;
+module_param(i10_target_poll_idle_us, int, 0644);
+MODULE_PARM_DESC(i10_target_poll_idle_us,
+	"least time a busy-poll thread spins without work before sleeping");
+
+static int i10_target_caravan_stage_max = 512;
+module_param(i10_target_caravan_stage_max, int, 0644);
+MODULE_PARM_DESC(i10_target_caravan_stage_max,
+	"PDUs and data up to this size are copied into the caravan, 0 never");
 
 enum i10_target_send_state {
 	I10_TARGET_SEND_DATA_PDU,
@@ -51,6 +110,7 @@ enum i10_target_recv_state {
 
 enum {
 	I10_TARGET_F_INIT_FAILED = (1 << 0),
+	I10_TARGET_F_POOLED	= (1 << 1),
 };
 
 struct i10_target_cmd {
@@ -72,6 +132,11 @@ struct i10_target_cmd {
 	struct msghdr			recv_msg;
 	struct kvec			*iov;
 	u32				flags;
+	u16				tag;
+
+	/* Pool slot: sgl and iovs for up to pool_cmd_pages pages */
+	struct scatterlist		*pool_sg;
+	struct kvec			*pool_iov;
 
 	struct list_head		entry;
 	struct llist_node		lentry;
@@ -95,44 +160,138 @@ struct i10_target_cmd_caravan {
 	struct i10_target_cmd	*cmd;
 };
 
+/*
+ * i10 lanes: responses are aggregated per traffic class, each class in
+ * a caravan of its own.  Lanes are flushed in enum order.
+ */
+enum i10_target_lane {
+	I10_TARGET_LANE_DATA = 0,	/* C2H data and read responses */
+	I10_TARGET_LANE_CTRL,		/* R2Ts and all other responses */
+	I10_TARGET_NR_LANES,
+};
+
+struct i10_target_lane_profile {
+	const char		*name;
+	size_t			capacity;	/* caravan size in bytes */
+	int			batch;		/* max commands per caravan */
+	int			*delay_us;	/* NULL: no delayed doorbell */
+};
+
+static const struct i10_target_lane_profile
+i10_target_lanes[I10_TARGET_NR_LANES] = {
+	[I10_TARGET_LANE_DATA] = {
+		.name		= "data",
+		.capacity	= I10_CARAVAN_CAPACITY,
+		.batch		= I10_TARGET_SEND_BUDGET,
+		.delay_us	= &i10_target_delayed_doorbell_us,
+	},
+	[I10_TARGET_LANE_CTRL] = {
+		.name		= "ctrl",
+		.capacity	= I10_CARAVAN2_CAPACITY,
+		.batch		= I10_TARGET_SEND_BUDGET,
+	},
+};
+
+/* Why a caravan went out, see i10_target_flush_reason() */
+enum i10_target_flush_reason {
+	I10_TARGET_FLUSH_FULL,
+	I10_TARGET_FLUSH_NODELAY,
+	I10_TARGET_FLUSH_TIMER,
+	I10_TARGET_FLUSH_DRAINED,
+	I10_TARGET_NR_FLUSH_REASONS,
+};
+
+static const char * const i10_target_flush_reason_names[] = {
+	[I10_TARGET_FLUSH_FULL]		= "full",
+	[I10_TARGET_FLUSH_NODELAY]	= "nodelay",
+	[I10_TARGET_FLUSH_TIMER]	= "timer",
+	[I10_TARGET_FLUSH_DRAINED]	= "drained",
+};
+
+#define I10_TARGET_STATS_BUCKETS	8
+/* bytes buckets count 1K units, labeled by their lower bound: 0, 2K .. 128K */
+#define I10_TARGET_STATS_BYTES_SHIFT	10
+
+/*
+ * Per-caravan statistics, updated from io_work (timer_fires from the
+ * doorbell timer) and read via debugfs.
+ */
+struct i10_target_caravan_stats {
+	u64			bytes[I10_TARGET_STATS_BUCKETS]; /* log2, 2K.. */
+	u64			iovs[I10_TARGET_STATS_BUCKETS];	 /* log2, 1.. */
+	u64			flushes[I10_TARGET_NR_FLUSH_REASONS];
+	u64			timer_fires;
+	u64			early_rings;
+	u64			nospace;
+	u64			staged;		/* bytes copied into stage */
+	u64			flush_lat_ns;	/* first byte queued to sent */
+	u64			flush_lat_max_ns;
+};
+
+/* One i10 lane: a caravan of PDUs and the commands it completes */
+struct i10_target_caravan {
+	struct i10_target_queue	*queue;
+	const struct i10_target_lane_profile *profile;
+
+	struct kvec		*iovs;
+	int			nr_iovs;
+	size_t			len;
+	size_t			sent;
+	struct i10_target_cmd_caravan *cmds;
+	int			nr_cmds;
+	bool			send_now;
+
+	struct page		**mapped;
+	int			nr_mapped;
+
+	/* Zero-copy caravans: data pages sent by reference, per iov */
+	struct bio_vec		*bvecs;
+
+	/* Small PDUs and data copied in, see i10_target_caravan_stage() */
+	void			*stage;		/* allocated on first use */
+	size_t			stage_len;
+	size_t			stage_size;
+	bool			stage_used;	/* since the last shrink */
+
+	/* For i10 delayed doorbells */
+	struct hrtimer		doorbell_timer;
+	bool			timer_fired;
+
+	u64			first_ns;
+	struct i10_target_caravan_stats stats;
+};
+
 struct i10_target_queue {
 	struct socket		*sock;
 	struct i10_target_port	*port;
 	struct work_struct	io_work;
 	int			cpu;
+	struct i10_target_poller *poller;	/* NULL: io_work on i10_target_wq */
+	struct list_head	poll_entry;
 	struct nvmet_cq		nvme_cq;
 	struct nvmet_sq		nvme_sq;
 
-	/* send state */
-	struct i10_target_cmd	*cmds;
+	/*
+	 * Command contexts by tag, allocated as needed up to nr_cmds and
+	 * freed again when idle, see i10_target_new_cmd()
+	 */
+	struct i10_target_cmd	**cmds;
 	unsigned int		nr_cmds;
+	int			nr_alloc_cmds;
+	int			nr_free_cmds;
+	int			free_low;	/* fewest free since shrink */
+	bool			shrink;
+
+	/* send state */
 	struct list_head	free_list;
 	struct llist_head	resp_list;
 	struct list_head	resp_send_list;
 	int			send_list_len;
 	struct i10_target_cmd	*snd_cmd;
 
-	/* For i10 target caravans */
-	struct kvec		*caravan_iovs;
-	int			nr_iovs;
-	size_t			caravan_len;
-	struct i10_target_cmd_caravan *caravan_cmds;
-	int			nr_caravan_cmds;
-	bool			send_now;
-
-	struct page		**caravan_mapped;
-	int			nr_caravan_mapped;
-
-	/* For i10 target caravans2 */
-	struct kvec		*caravan2_iovs;
-	int			nr_iovs2;
-	size_t			caravan2_len;
-	struct i10_target_cmd_caravan *caravan2_cmds;
-	int			nr_caravan2_cmds;
-	bool			send_now2;
-
-	struct page		**caravan2_mapped;
-	int			nr_caravan2_mapped;
+	/* For i10 target lanes */
+	bool			zero_copy;
+	struct i10_target_caravan caravans[I10_TARGET_NR_LANES];
 
 	/* recv state */
 	int			offset;
@@ -141,11 +300,26 @@ struct i10_target_queue {
 	struct i10_target_cmd	*cmd;
 	union nvme_tcp_pdu	pdu;
 
+	/*
+	 * Commands decoded in one receive round, executed under a single
+	 * plug once the socket is released.  Each PDU of the round adds at
+	 * most one command, plus the one whose data finishes first.
+	 */
+	struct i10_target_cmd	*exec_batch[I10_TARGET_RECV_BUDGET + 1];
+	int			nr_exec;
+	u64			exec_rounds;
+	u64			exec_cmds;
+
+	/* QoS of the host, see i10_target_qos_hold() */
+	struct nvmet_qos	*qos;
+	struct list_head	qos_list;	/* commands held back */
+	struct hrtimer		qos_timer;
+	u64			qos_held;
+
 	/* digest state */
 	bool			hdr_digest;
 	bool			data_digest;
-	struct ahash_request	*snd_hash;
-	struct ahash_request	*rcv_hash;
+	u32			rcv_crc;	/* H2C data digest so far */
 
 	spinlock_t		state_lock;
 	enum i10_target_queue_state state;
@@ -158,6 +332,18 @@ struct i10_target_queue {
 	struct list_head	queue_list;
 
 	struct i10_target_cmd	connect;
+	struct dentry		*debugfs_dir;
+
+	/* Data page pool, see i10_target_pool_get() */
+	struct list_head	pool;		/* free pages, by page->lru */
+	int			nr_pool;	/* free pages */
+	int			pool_size;	/* allocated pages */
+	int			pool_max;
+	int			pool_low;	/* fewest free since shrink */
+	int			pool_cmd_pages;
+	u64			pool_hits;
+	u64			pool_misses;
+	u64			p2p_cmds;
 
 	struct page_frag_cache	pf_cache;
 
@@ -180,14 +366,63 @@ static LIST_HEAD(i10_target_queue_list);
 static DEFINE_MUTEX(i10_target_queue_mutex);
 
 static struct workqueue_struct *i10_target_wq;
+static struct kmem_cache *i10_target_cmd_cache;
+
+/*
+ * Busy-poll mode, enabled per port with param_busy_poll: a kthread pinned
+ * to each CPU runs the io_work of all of its queues in turn rather than
+ * having them requeued on i10_target_wq.  It spins on the sockets (and
+ * their NAPI contexts) while there is work, and sleeps until kicked once
+ * it has been idle for spin_ns.  spin_ns adapts between
+ * i10_target_poll_idle_us and 8 times that: it doubles when a kick comes
+ * soon after going to sleep and halves when the sleep was long.
+ *
+ * A queue is run without the lock held, since an admin connect executes
+ * from its io_run and ends up in flush_scheduled_work(), which may wait
+ * for an accept or release work that needs the lock.  Instead the queue
+ * being run is pinned as running, and i10_target_poller_del() waits for
+ * the poller to move past it before taking it off the list.
+ */
+struct i10_target_poller {
+	struct task_struct	*task;
+	int			cpu;
+	struct mutex		lock;	/* queues and running */
+	struct list_head	queues;
+	struct i10_target_queue	*running;
+	wait_queue_head_t	run_wait;	/* running changed */
+	wait_queue_head_t	wait;
+	bool			kicked;
+	u64			spin_ns;
+};
+
+static struct i10_target_poller *i10_target_pollers;
+static DEFINE_MUTEX(i10_target_poller_mutex);
+
+static inline void i10_target_kick(struct i10_target_queue *queue)
+{
+	struct i10_target_poller *poller = queue->poller;
+
+	if (!poller) {
+		queue_work_on(queue->cpu, i10_target_wq, &queue->io_work);
+		return;
+	}
+
+	WRITE_ONCE(poller->kicked, true);
+	if (wq_has_sleeper(&poller->wait))
+		wake_up(&poller->wait);
+}
+static struct dentry *i10_target_debugfs_root;
 static struct nvmet_fabrics_ops i10_target_ops;
 static void i10_target_free_cmd(struct i10_target_cmd *c);
+static void i10_target_schedule_release_queue(struct i10_target_queue *queue);
 static void i10_target_finish_cmd(struct i10_target_cmd *cmd);
+static struct i10_target_cmd *i10_target_new_cmd(struct i10_target_queue *queue);
+static void i10_target_shrink(struct i10_target_queue *queue);
 
 static inline u16 i10_target_cmd_tag(struct i10_target_queue *queue,
 		struct i10_target_cmd *cmd)
 {
-	return cmd - queue->cmds;
+	return cmd->tag;
 }
 
 static inline bool i10_target_has_data_in(struct i10_target_cmd *cmd)
@@ -221,9 +456,15 @@ i10_target_get_cmd(struct i10_target_queue *queue)
 
 	cmd = list_first_entry_or_null(&queue->free_list,
 				struct i10_target_cmd, entry);
-	if (!cmd)
-		return NULL;
+	if (!cmd) {
+		cmd = i10_target_new_cmd(queue);
+		if (!cmd)
+			return NULL;
+	}
 	list_del_init(&cmd->entry);
+	if (likely(cmd != &queue->connect) &&
+	    --queue->nr_free_cmds < queue->free_low)
+		queue->free_low = queue->nr_free_cmds;
 
 	cmd->rbytes_done = cmd->wbytes_done = 0;
 	cmd->pdu_len = 0;
@@ -239,28 +480,76 @@ static inline void i10_target_put_cmd(struct i10_target_cmd *cmd)
 		return;
 
 	list_add_tail(&cmd->entry, &cmd->queue->free_list);
+	cmd->queue->nr_free_cmds++;
+}
+
+/*
+ * Digests are the exception, so their tests stay patched out of the PDU
+ * paths unless some queue actually negotiated one.
+ */
+static DEFINE_STATIC_KEY_FALSE(i10_target_digest_key);
+
+static inline bool i10_target_hdr_digest(struct i10_target_queue *queue)
+{
+	return static_branch_unlikely(&i10_target_digest_key) &&
+		queue->hdr_digest;
+}
+
+static inline bool i10_target_data_digest(struct i10_target_queue *queue)
+{
+	return static_branch_unlikely(&i10_target_digest_key) &&
+		queue->data_digest;
+}
+
+static void i10_target_digest_get(struct i10_target_queue *queue)
+{
+	if (queue->hdr_digest || queue->data_digest)
+		static_branch_inc(&i10_target_digest_key);
+}
+
+static void i10_target_digest_put(struct i10_target_queue *queue)
+{
+	if (queue->hdr_digest || queue->data_digest)
+		static_branch_dec(&i10_target_digest_key);
 }
 
 static inline u8 i10_target_hdgst_len(struct i10_target_queue *queue)
 {
-	return queue->hdr_digest ? NVME_TCP_DIGEST_LENGTH : 0;
+	return i10_target_hdr_digest(queue) ? NVME_TCP_DIGEST_LENGTH : 0;
 }
 
 static inline u8 i10_target_ddgst_len(struct i10_target_queue *queue)
 {
-	return queue->data_digest ? NVME_TCP_DIGEST_LENGTH : 0;
+	return i10_target_data_digest(queue) ? NVME_TCP_DIGEST_LENGTH : 0;
+}
+
+/*
+ * Digests use the crc32c() library directly, which picks the SSE4.2 or
+ * PCLMUL variant where available, instead of building an ahash request
+ * and scatterlist for every PDU.
+ */
+static inline void i10_target_hdgst(void *pdu, size_t len)
+{
+	*(__le32 *)(pdu + len) = cpu_to_le32(~crc32c(~0, pdu, len));
 }
 
-static inline void i10_target_hdgst(struct ahash_request *hash,
-		void *pdu, size_t len)
+static __wsum i10_target_skb_crc_update(const void *mem, int len, __wsum crc)
 {
-	struct scatterlist sg;
+	return (__force __wsum)crc32c((__force u32)crc, mem, len);
+}
 
-	sg_init_one(&sg, pdu, len);
-	ahash_request_set_crypt(hash, &sg, pdu + len, len);
-	crypto_ahash_digest(hash);
+static __wsum i10_target_skb_crc_combine(__wsum crc, __wsum crc2,
+		int offset, int len)
+{
+	return (__force __wsum)__crc32c_le_combine((__force u32)crc,
+			(__force u32)crc2, len);
 }
 
+static const struct skb_checksum_ops i10_target_skb_crc_ops = {
+	.update		= i10_target_skb_crc_update,
+	.combine	= i10_target_skb_crc_combine,
+};
+
 static int i10_target_verify_hdgst(struct i10_target_queue *queue,
 	void *pdu, size_t len)
 {
@@ -275,7 +564,7 @@ static int i10_target_verify_hdgst(struct i10_target_queue *queue,
 	}
 
 	recv_digest = *(__le32 *)(pdu + hdr->hlen);
-	i10_target_hdgst(queue->rcv_hash, pdu, len);
+	i10_target_hdgst(pdu, len);
 	exp_digest = *(__le32 *)(pdu + hdr->hlen);
 	if (recv_digest != exp_digest) {
 		pr_err("queue %d: header digest error: recv %#x expected %#x\n",
@@ -300,6 +589,7 @@ static int i10_target_check_ddgst(struct i10_target_queue *queue, void *pdu)
 		pr_err("queue %d: data digest flag is cleared\n", queue->idx);
 		return -EPROTO;
 	}
+	queue->rcv_crc = ~0;
 
 	return 0;
 }
@@ -311,30 +601,43 @@ static void i10_target_unmap_pdu_iovec(struct i10_target_cmd *cmd)
 
 	sg = &cmd->req.sg[cmd->sg_idx];
 
-	for (i = 0; i < cmd->nr_mapped; i++)
-		kunmap(sg_page(&sg[i]));
+	for (i = 0; i < cmd->nr_mapped; i++, sg = sg_next(sg))
+		kunmap(sg_page(sg));
+	cmd->nr_mapped = 0;
 }
 
+/*
+ * Map the part of the data the next PDU carries, one iov per sg entry it
+ * touches.  Entries are not always a page: a p2pmem sgl is a single one
+ * covering the whole transfer, in memory that is contiguous in the
+ * kernel mapping, so the walk goes by byte offset.
+ */
 static void i10_target_map_pdu_iovec(struct i10_target_cmd *cmd)
 {
 	struct kvec *iov = cmd->iov;
 	struct scatterlist *sg;
-	u32 length, offset, sg_offset;
+	u32 length, offset;
+	int i;
 
 	length = cmd->pdu_len;
-	cmd->nr_mapped = DIV_ROUND_UP(length, PAGE_SIZE);
 	offset = cmd->rbytes_done;
-	cmd->sg_idx = DIV_ROUND_UP(offset, PAGE_SIZE);
-	sg_offset = offset % PAGE_SIZE;
-	sg = &cmd->req.sg[cmd->sg_idx];
+	for_each_sg(cmd->req.sg, sg, cmd->req.sg_cnt, i) {
+		if (offset < sg->length)
+			break;
+		offset -= sg->length;
+	}
+	cmd->sg_idx = i;
+	cmd->nr_mapped = 0;
 
 	while (length) {
-		u32 iov_len = min_t(u32, length, sg->length - sg_offset);
+		u32 iov_len = min_t(u32, length, sg->length - offset);
 
-		iov->iov_base = kmap(sg_page(sg)) + sg->offset + sg_offset;
+		iov->iov_base = kmap(sg_page(sg)) + sg->offset + offset;
 		iov->iov_len = iov_len;
+		cmd->nr_mapped++;
 
 		length -= iov_len;
+		offset = 0;
 		sg = sg_next(sg);
 		iov++;
 	}
@@ -343,13 +646,175 @@ static void i10_target_map_pdu_iovec(struct i10_target_cmd *cmd)
 		cmd->nr_mapped, cmd->pdu_len);
 }
 
+/*
+ * May run from i10_target_recv_skb() with the socket locked, so tear
+ * the queue down through release_work rather than a socket shutdown.
+ */
 static void i10_target_fatal_error(struct i10_target_queue *queue)
 {
 	queue->rcv_state = I10_TARGET_RECV_ERR;
 	if (queue->nvme_sq.ctrl)
 		nvmet_ctrl_fatal_error(queue->nvme_sq.ctrl);
 	else
-		kernel_sock_shutdown(queue->sock, SHUT_RDWR);
+		i10_target_schedule_release_queue(queue);
+}
+
+/*
+ * Commands borrow their data pages from a per-queue pool, along with the
+ * scatterlist and iov array of their slot, rather than going to
+ * sgl_alloc() and kmalloc_array() for every I/O.  The pool grows as
+ * commands need pages, up to pool_max, and gives back what it has not
+ * needed for a while in i10_target_shrink().  It is only used from
+ * io_work, so it needs no locking.  Returns false if the command has to
+ * use the allocator.
+ */
+static bool i10_target_pool_get(struct i10_target_cmd *cmd, u32 len)
+{
+	struct i10_target_queue *queue = cmd->queue;
+	int i, nr = DIV_ROUND_UP(len, PAGE_SIZE);
+	struct scatterlist *sg = cmd->pool_sg;
+
+	if (!sg)
+		return false;
+	if (nr > queue->pool_cmd_pages)
+		goto miss;
+
+	while (queue->nr_pool < nr && queue->pool_size < queue->pool_max) {
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page)
+			break;
+		list_add(&page->lru, &queue->pool);
+		queue->nr_pool++;
+		queue->pool_size++;
+	}
+	if (nr > queue->nr_pool)
+		goto miss;
+
+	sg_init_table(sg, nr);
+	for (i = 0; i < nr; i++) {
+		struct page *page = list_first_entry(&queue->pool,
+				struct page, lru);
+		u32 n = min_t(u32, len, PAGE_SIZE);
+
+		list_del(&page->lru);
+		sg_set_page(&sg[i], page, n, 0);
+		len -= n;
+	}
+	queue->nr_pool -= nr;
+	if (queue->nr_pool < queue->pool_low)
+		queue->pool_low = queue->nr_pool;
+
+	cmd->req.sg = sg;
+	cmd->req.sg_cnt = nr;
+	cmd->iov = cmd->pool_iov;
+	cmd->flags |= I10_TARGET_F_POOLED;
+	queue->pool_hits++;
+	return true;
+miss:
+	queue->pool_misses++;
+	return false;
+}
+
+static void i10_target_pool_put(struct i10_target_cmd *cmd)
+{
+	struct i10_target_queue *queue = cmd->queue;
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(cmd->req.sg, sg, cmd->req.sg_cnt, i) {
+		struct page *page = sg_page(sg);
+
+		/* A zero-copy skb still holds it; let the skb have it */
+		if (page_count(page) != 1) {
+			put_page(page);
+			queue->pool_size--;
+			continue;
+		}
+		list_add(&page->lru, &queue->pool);
+		queue->nr_pool++;
+	}
+	cmd->flags &= ~I10_TARGET_F_POOLED;
+}
+
+static void i10_target_free_data(struct i10_target_cmd *cmd)
+{
+	if (cmd->req.mem_sg) {
+		nvmet_mem_free_sgl(&cmd->req);
+	} else if (cmd->flags & I10_TARGET_F_POOLED) {
+		i10_target_pool_put(cmd);
+	} else {
+		kfree(cmd->iov);
+		nvmet_req_free_sgl(&cmd->req);
+		cmd->req.p2p_dev = NULL;
+	}
+	cmd->iov = NULL;
+	cmd->req.sg = NULL;
+}
+
+/*
+ * Write data for a namespace with p2pmem enabled is received straight
+ * into peer-to-peer memory, so the device reads it from its own BAR (or
+ * one next to it) instead of DRAM.  Reads keep using DRAM: their data is
+ * sent from the CPU or pinned by the NIC for zero-copy, and neither
+ * should be pointed at device memory.  nvmet falls back to regular
+ * memory when the controller has no p2pmem for the namespace.
+ */
+static inline bool i10_target_p2p_write(struct i10_target_cmd *cmd)
+{
+	struct nvmet_req *req = &cmd->req;
+
+	return IS_ENABLED(CONFIG_PCI_P2PDMA) && req->sq->qid &&
+		req->sq->ctrl && req->sq->ctrl->p2p_client &&
+		req->ns && req->ns->use_p2pmem && nvme_is_write(req->cmd);
+}
+
+/*
+ * nvmet picks p2pmem reachable by both the namespace and the controller's
+ * p2p_client, which for i10 is the PCI device of the NIC the connection
+ * came in on.  Returns it with a reference held, or NULL.
+ */
+static struct device *i10_target_p2p_client(struct i10_target_queue *queue)
+{
+	struct dst_entry *dst = sk_dst_get(queue->sock->sk);
+	struct device *dev = NULL;
+
+	if (!dst)
+		return NULL;
+	if (dst->dev)
+		dev = dst->dev->dev.parent;
+	dev = dev && dev_is_pci(dev) ? get_device(dev) : NULL;
+	dst_release(dst);
+	return dev;
+}
+
+static void i10_target_init_pool(struct i10_target_queue *queue)
+{
+	int cmd_pages = i10_pool_cmd_pages;
+
+	if (cmd_pages <= 0)
+		return;
+
+	/* Every slot must hold a full in-capsule write, or it would miss */
+	queue->pool_cmd_pages = max_t(int, cmd_pages,
+		DIV_ROUND_UP(queue->port->nport->inline_data_size, PAGE_SIZE));
+	/* Grown to without limit it would pin 32M for each I/O queue */
+	queue->pool_max = min(queue->nr_cmds * queue->pool_cmd_pages,
+			i10_pool_max_pages);
+}
+
+/* Free up to @nr of the pool's free pages, the longest unused first */
+static void i10_target_pool_trim(struct i10_target_queue *queue, int nr)
+{
+	while (nr-- > 0 && queue->nr_pool) {
+		struct page *page = list_last_entry(&queue->pool,
+				struct page, lru);
+
+		list_del(&page->lru);
+		__free_page(page);
+		queue->nr_pool--;
+		queue->pool_size--;
+	}
 }
 
 static int i10_target_map_data(struct i10_target_cmd *cmd)
@@ -371,9 +836,25 @@ static int i10_target_map_data(struct i10_target_cmd *cmd)
 	}
 	cmd->req.transfer_len += len;
 
-	cmd->req.sg = sgl_alloc(len, GFP_KERNEL, &cmd->req.sg_cnt);
-	if (!cmd->req.sg)
-		return NVME_SC_INTERNAL;
+	/* Reads from a null or RAM namespace go straight from its pages */
+	if (!nvmet_mem_alloc_sgl(&cmd->req)) {
+		cmd->cur_sg = cmd->req.sg;
+		return 0;
+	}
+
+	if (i10_target_p2p_write(cmd)) {
+		if (nvmet_req_alloc_sgl(&cmd->req))
+			return NVME_SC_INTERNAL;
+		if (cmd->req.p2p_dev)
+			cmd->queue->p2p_cmds++;
+	} else if (i10_target_pool_get(cmd, len)) {
+		cmd->cur_sg = cmd->req.sg;
+		return 0;
+	} else {
+		cmd->req.sg = sgl_alloc(len, GFP_KERNEL, &cmd->req.sg_cnt);
+		if (!cmd->req.sg)
+			return NVME_SC_INTERNAL;
+	}
 	cmd->cur_sg = cmd->req.sg;
 
 	if (i10_target_has_data_in(cmd)) {
@@ -385,16 +866,24 @@ static int i10_target_map_data(struct i10_target_cmd *cmd)
 
 	return 0;
 err:
-	sgl_free(cmd->req.sg);
+	nvmet_req_free_sgl(&cmd->req);
+	cmd->req.p2p_dev = NULL;
 	return NVME_SC_INTERNAL;
 }
 
-static void i10_target_ddgst(struct ahash_request *hash,
-		struct i10_target_cmd *cmd)
+static void i10_target_ddgst(struct i10_target_cmd *cmd)
 {
-	ahash_request_set_crypt(hash, cmd->req.sg,
-		(void *)&cmd->exp_ddgst, cmd->req.transfer_len);
-	crypto_ahash_digest(hash);
+	struct scatterlist *sg;
+	u32 crc = ~0;
+	int i;
+
+	for_each_sg(cmd->req.sg, sg, cmd->req.sg_cnt, i) {
+		void *vaddr = kmap_atomic(sg_page(sg));
+
+		crc = crc32c(crc, vaddr + sg->offset, sg->length);
+		kunmap_atomic(vaddr);
+	}
+	cmd->exp_ddgst = cpu_to_le32(~crc);
 }
 
 static void i10_target_setup_c2h_data_pdu(struct i10_target_cmd *cmd)
@@ -418,14 +907,14 @@ static void i10_target_setup_c2h_data_pdu(struct i10_target_cmd *cmd)
 	pdu->data_length = cpu_to_le32(cmd->req.transfer_len);
 	pdu->data_offset = cpu_to_le32(cmd->wbytes_done);
 
-	if (queue->data_digest) {
+	if (i10_target_data_digest(queue)) {
 		pdu->hdr.flags |= NVME_TCP_F_DDGST;
-		i10_target_ddgst(queue->snd_hash, cmd);
+		i10_target_ddgst(cmd);
 	}
 
-	if (cmd->queue->hdr_digest) {
+	if (i10_target_hdr_digest(cmd->queue)) {
 		pdu->hdr.flags |= NVME_TCP_F_HDGST;
-		i10_target_hdgst(queue->snd_hash, pdu, sizeof(*pdu));
+		i10_target_hdgst(pdu, sizeof(*pdu));
 	}
 }
 
@@ -448,9 +937,9 @@ static void i10_target_setup_r2t_pdu(struct i10_target_cmd *cmd)
 	pdu->ttag = i10_target_cmd_tag(cmd->queue, cmd);
 	pdu->r2t_length = cpu_to_le32(cmd->req.transfer_len - cmd->rbytes_done);
 	pdu->r2t_offset = cpu_to_le32(cmd->rbytes_done);
-	if (cmd->queue->hdr_digest) {
+	if (i10_target_hdr_digest(cmd->queue)) {
 		pdu->hdr.flags |= NVME_TCP_F_HDGST;
-		i10_target_hdgst(queue->snd_hash, pdu, sizeof(*pdu));
+		i10_target_hdgst(pdu, sizeof(*pdu));
 	}
 }
 
@@ -468,9 +957,9 @@ static void i10_target_setup_response_pdu(struct i10_target_cmd *cmd)
 	pdu->hdr.hlen = sizeof(*pdu);
 	pdu->hdr.pdo = 0;
 	pdu->hdr.plen = cpu_to_le32(pdu->hdr.hlen + hdgst);
-	if (cmd->queue->hdr_digest) {
+	if (i10_target_hdr_digest(cmd->queue)) {
 		pdu->hdr.flags |= NVME_TCP_F_HDGST;
-		i10_target_hdgst(queue->snd_hash, pdu, sizeof(*pdu));
+		i10_target_hdgst(pdu, sizeof(*pdu));
 	}
 }
 
@@ -497,20 +986,110 @@ static inline bool i10_target_is_admin_queue(struct i10_target_queue *queue)
 	return queue->nvme_sq.qid == 0; 
 }
 
-static inline bool i10_target_is_caravan_full(struct i10_target_queue *queue)
+/* A delayed doorbell rings early once this many commands are aboard */
+static inline int i10_target_caravan_batch(struct i10_target_caravan *caravan)
+{
+	const struct i10_target_lane_profile *profile = caravan->profile;
+
+	if (!profile->delay_us)
+		return profile->batch;
+	return clamp(READ_ONCE(i10_target_doorbell_batch), 1, profile->batch);
+}
+
+static inline bool i10_target_is_caravan_full(struct i10_target_caravan *caravan)
+{
+	return caravan->sent ||
+		(caravan->len >= caravan->profile->capacity) ||
+		(caravan->nr_iovs >= I10_TARGET_SEND_BUDGET * 3) ||
+		(caravan->nr_cmds >= i10_target_caravan_batch(caravan)) ||
+		(caravan->nr_mapped >= I10_TARGET_SEND_BUDGET);
+}
+
+/*
+ * Copy @len bytes at @base into the caravan's staging buffer if they are
+ * small enough and fit.  What is staged next to the previous iov extends
+ * it, so runs of responses, and of C2H data PDUs with the small reads
+ * they carry, go out as a single kvec instead of many tiny ones.  Larger
+ * data still goes by reference.
+ */
+static bool i10_target_caravan_stage(struct i10_target_caravan *caravan,
+		const void *base, size_t len)
+{
+	struct kvec *last;
+	void *dst;
+
+	if (len > READ_ONCE(i10_target_caravan_stage_max) ||
+	    len > caravan->stage_size - caravan->stage_len)
+		return false;
+
+	if (unlikely(!caravan->stage)) {
+		caravan->stage = kmalloc(caravan->stage_size,
+				GFP_NOWAIT | __GFP_NOWARN);
+		if (!caravan->stage)
+			return false;
+	}
+	caravan->stage_used = true;
+
+	dst = caravan->stage + caravan->stage_len;
+	memcpy(dst, base, len);
+	caravan->stage_len += len;
+	caravan->stats.staged += len;
+	if (!caravan->len)
+		caravan->first_ns = ktime_get_ns();
+	caravan->len += len;
+
+	if (caravan->nr_iovs) {
+		last = &caravan->iovs[caravan->nr_iovs - 1];
+		if (last->iov_base && last->iov_base + last->iov_len == dst) {
+			last->iov_len += len;
+			return true;
+		}
+	}
+	caravan->iovs[caravan->nr_iovs].iov_base = dst;
+	caravan->iovs[caravan->nr_iovs++].iov_len = len;
+	return true;
+}
+
+/* Queue @len bytes by reference; @base is NULL for a zero-copy bvec */
+static inline void __i10_target_caravan_add(struct i10_target_caravan *caravan,
+		void *base, size_t len)
+{
+	if (!caravan->len)
+		caravan->first_ns = ktime_get_ns();
+	caravan->iovs[caravan->nr_iovs].iov_base = base;
+	caravan->iovs[caravan->nr_iovs++].iov_len = len;
+	caravan->len += len;
+}
+
+static inline void i10_target_caravan_add(struct i10_target_caravan *caravan,
+		void *base, size_t len)
 {
-	return (queue->caravan_len >= I10_CARAVAN_CAPACITY) ||
-		(queue->nr_iovs >= I10_TARGET_SEND_BUDGET * 3) ||
-		(queue->nr_caravan_cmds >= I10_TARGET_SEND_BUDGET) ||
-		(queue->nr_caravan_mapped >= I10_TARGET_SEND_BUDGET);
+	if (!i10_target_caravan_stage(caravan, base, len))
+		__i10_target_caravan_add(caravan, base, len);
 }
 
-static inline bool i10_target_is_caravan2_full(struct i10_target_queue *queue)
+static inline void i10_target_caravan_add_page(
+		struct i10_target_caravan *caravan, struct page *page,
+		size_t offset, size_t len)
 {
-	return (queue->caravan2_len >= I10_CARAVAN2_CAPACITY) ||
-		(queue->nr_iovs2 >= I10_TARGET_SEND_BUDGET * 3) ||
-		(queue->nr_caravan2_cmds >= I10_TARGET_SEND_BUDGET) ||
-		(queue->nr_caravan2_mapped >= I10_TARGET_SEND_BUDGET);
+	if (len <= READ_ONCE(i10_target_caravan_stage_max)) {
+		void *vaddr = kmap_atomic(page);
+		bool staged;
+
+		staged = i10_target_caravan_stage(caravan, vaddr + offset, len);
+		kunmap_atomic(vaddr);
+		if (staged)
+			return;
+	}
+
+	if (caravan->bvecs) {
+		caravan->bvecs[caravan->nr_iovs].bv_page = page;
+		caravan->bvecs[caravan->nr_iovs].bv_offset = offset;
+		__i10_target_caravan_add(caravan, NULL, len);
+	} else {
+		caravan->mapped[caravan->nr_mapped++] = page;
+		__i10_target_caravan_add(caravan, kmap(page) + offset, len);
+	}
 }
 
 static struct i10_target_cmd *i10_target_fetch_cmd(struct i10_target_queue *queue)
@@ -548,8 +1127,11 @@ static void i10_target_queue_response(struct nvmet_req *req)
 		container_of(req, struct i10_target_cmd, req);
 	struct i10_target_queue	*queue = cmd->queue;
 
+	trace_i10_target_queue_response(queue->idx, queue->nvme_sq.qid,
+		req->cmd->common.command_id, le16_to_cpu(req->rsp->status),
+		i10_target_need_data_in(cmd));
 	llist_add(&cmd->lentry, &queue->resp_list);
-	queue_work_on(cmd->queue->cpu, i10_target_wq, &cmd->queue->io_work);
+	i10_target_kick(queue);
 }
 
 static int i10_target_try_send_data_pdu(struct i10_target_cmd *cmd)
@@ -561,14 +1143,15 @@ static int i10_target_try_send_data_pdu(struct i10_target_cmd *cmd)
 
 	/* Caravans: data PDU aggregation */
 	if (!i10_target_is_admin_queue(queue)) {
-		if (i10_target_is_caravan_full(queue)) {
-			queue->send_now = true;
+		struct i10_target_caravan *caravan =
+			&queue->caravans[I10_TARGET_LANE_DATA];
+
+		if (i10_target_is_caravan_full(caravan)) {
+			caravan->send_now = true;
 			return 1;
 		}
-		queue->caravan_iovs[queue->nr_iovs].iov_base =
-			cmd->data_pdu + cmd->offset;
-		queue->caravan_iovs[queue->nr_iovs++].iov_len = left;
-		queue->caravan_len += left;
+		i10_target_caravan_add(caravan,
+			(void *)cmd->data_pdu + cmd->offset, left);
 		ret = left;
 	}
 	else
@@ -601,15 +1184,15 @@ static int i10_target_try_send_data(struct i10_target_cmd *cmd)
 
 		/* Caravans: I/O data aggregation */
 		if (!i10_target_is_admin_queue(queue)) {
-			if (i10_target_is_caravan_full(queue)) {
-				queue->send_now = true;
+			struct i10_target_caravan *caravan =
+				&queue->caravans[I10_TARGET_LANE_DATA];
+
+			if (i10_target_is_caravan_full(caravan)) {
+				caravan->send_now = true;
 				return 1;
 			}
-			queue->caravan_iovs[queue->nr_iovs].iov_base =
-				kmap(page) + cmd->offset;
-			queue->caravan_iovs[queue->nr_iovs++].iov_len = left;
-			queue->caravan_mapped[queue->nr_caravan_mapped++] = page;
-			queue->caravan_len += left;
+			i10_target_caravan_add_page(caravan, page, cmd->offset,
+					left);
 			ret = left;
 		}
 		else
@@ -628,7 +1211,7 @@ static int i10_target_try_send_data(struct i10_target_cmd *cmd)
 		}
 	}
 
-	if (queue->data_digest) {
+	if (i10_target_data_digest(queue)) {
 		cmd->state = I10_TARGET_SEND_DDGST;
 		cmd->offset = 0;
 	} else {
@@ -652,46 +1235,26 @@ static int i10_target_try_send_response(struct i10_target_cmd *cmd,
 	else
 		flags |= MSG_EOR;
 
-	/* Caravans: response PDU aggregation */
-	if (!i10_target_is_admin_queue(queue))
-	{
-		/* Caravans: write response PDU aggregation */
-		if (!nvme_is_write(cmd->req.cmd))
-		{
-			if (i10_target_is_caravan_full(queue)) {
-			queue->send_now = true;
-			return 1;
-			}
-			queue->caravan_iovs[queue->nr_iovs].iov_base =
-				cmd->rsp_pdu + cmd->offset;
-			queue->caravan_iovs[queue->nr_iovs++].iov_len = left;
-			queue->caravan_cmds[queue->nr_caravan_cmds++].cmd = cmd;
-			queue->caravan_len += left;
-			cmd->queue->snd_cmd = NULL;
-
-			cmd->offset += left;
+	/*
+	 * Caravans: response PDU aggregation.  Read responses follow their
+	 * data in the data lane, everything else goes to the ctrl lane.
+	 */
+	if (!i10_target_is_admin_queue(queue)) {
+		struct i10_target_caravan *caravan =
+			&queue->caravans[nvme_is_write(cmd->req.cmd) ?
+				I10_TARGET_LANE_CTRL : I10_TARGET_LANE_DATA];
+
+		if (i10_target_is_caravan_full(caravan)) {
+			caravan->send_now = true;
 			return 1;
 		}
-		
-		/* Caravans: read response PDU aggregation */
-		else
-		{
-			
-			if (i10_target_is_caravan2_full(queue)) {
-			queue->send_now2 = true;
-			return 1;
-			}
-			queue->caravan2_iovs[queue->nr_iovs2].iov_base =
-				cmd->rsp_pdu + cmd->offset;
-			queue->caravan2_iovs[queue->nr_iovs2++].iov_len = left;
-			queue->caravan2_cmds[queue->nr_caravan2_cmds++].cmd = cmd;
-			queue->caravan2_len += left;
-			cmd->queue->snd_cmd = NULL;
-
-			cmd->offset += left;
-			return 1;
+		i10_target_caravan_add(caravan,
+			(void *)cmd->rsp_pdu + cmd->offset, left);
+		caravan->cmds[caravan->nr_cmds++].cmd = cmd;
+		cmd->queue->snd_cmd = NULL;
 
-		}
+		cmd->offset += left;
+		return 1;
 	}
 
 	ret = kernel_sendpage(cmd->queue->sock, virt_to_page(cmd->rsp_pdu),
@@ -704,8 +1267,7 @@ static int i10_target_try_send_response(struct i10_target_cmd *cmd,
 	if (left)
 		return -EAGAIN;
 
-	kfree(cmd->iov);
-	sgl_free(cmd->req.sg);
+	i10_target_free_data(cmd);
 	cmd->queue->snd_cmd = NULL;
 	i10_target_put_cmd(cmd);
 	return 1;
@@ -726,14 +1288,15 @@ static int i10_target_try_send_r2t(struct i10_target_cmd *cmd, bool last_in_batc
 		flags |= MSG_EOR;
 	/* Caravans: r2t PDU aggregation */
 	if (!i10_target_is_admin_queue(queue)) {
-		if (i10_target_is_caravan2_full(queue)) {
-			queue->send_now2 = true;
+		struct i10_target_caravan *caravan =
+			&queue->caravans[I10_TARGET_LANE_CTRL];
+
+		if (i10_target_is_caravan_full(caravan)) {
+			caravan->send_now = true;
 			return 1;
 		}
-		queue->caravan2_iovs[queue->nr_iovs2].iov_base = cmd->r2t_pdu
-			+ cmd->offset;
-		queue->caravan2_iovs[queue->nr_iovs2++].iov_len = left;
-		queue->caravan2_len += left;
+		i10_target_caravan_add(caravan,
+			(void *)cmd->r2t_pdu + cmd->offset, left);
 		ret = left;
 	}
 	else
@@ -758,11 +1321,25 @@ static int i10_target_try_send_ddgst(struct i10_target_cmd *cmd)
 	struct i10_target_queue *queue = cmd->queue;
 	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
 	struct kvec iov = {
-		.iov_base = &cmd->exp_ddgst + cmd->offset,
+		.iov_base = (u8 *)&cmd->exp_ddgst + cmd->offset,
 		.iov_len = NVME_TCP_DIGEST_LENGTH - cmd->offset
 	};
 	int ret;
 
+	/* Caravans: the digest follows its data in the caravan */
+	if (!i10_target_is_admin_queue(queue)) {
+		struct i10_target_caravan *caravan =
+			&queue->caravans[I10_TARGET_LANE_DATA];
+
+		if (i10_target_is_caravan_full(caravan)) {
+			caravan->send_now = true;
+			return 1;
+		}
+		i10_target_caravan_add(caravan, iov.iov_base, iov.iov_len);
+		i10_target_setup_response_pdu(cmd);
+		return 1;
+	}
+
 	ret = kernel_sendmsg(queue->sock, &msg, &iov, 1, iov.iov_len);
 	if (unlikely(ret <= 0))
 		return ret;
@@ -821,156 +1398,351 @@ done_send:
 	return 1;
 }
 
-/* To check if there's enough room in tcp_sndbuf */
-static inline int i10_target_sndbuf_nospace(struct i10_target_queue *queue,
-		int length)
-{
-	return sk_stream_wspace(queue->sock->sk) < length;
-}	
-
-static int i10_target_try_send(struct i10_target_queue *queue,
-		int budget, int *sends)
-{
-	int i, ret = 0;
-
-	for (i = 0; i < budget; i++) {
-		ret = i10_target_try_send_one(queue, i == budget - 1);
-
-		/* Send i10 caravans */
-		if ((queue->send_now || ret <= 0 || i == budget - 1) &&
-			queue->caravan_len) {
-			struct msghdr msg =
-				{ .msg_flags = MSG_DONTWAIT | MSG_EOR };
-			int i10_ret, j;
-
-			if (i10_target_sndbuf_nospace(queue,
-				queue->caravan_len)) {
-				set_bit(SOCK_NOSPACE,
-					&queue->sock->sk->sk_socket->flags);
-				return 0;
-			}
-
-			i10_ret = kernel_sendmsg(queue->sock, &msg,
-					queue->caravan_iovs,
-					queue->nr_iovs, queue->caravan_len);
-			if (unlikely(i10_ret <= 0))
-				pr_err("I10_TARGET: kernel_sendmsg fails (i10_ret %d)\n",
-					i10_ret);
-
-			for (j = 0; j < queue->nr_caravan_cmds; j++) {
-				kfree(queue->caravan_cmds[j].cmd->iov);
-				sgl_free(queue->caravan_cmds[j].cmd->req.sg);
-				i10_target_put_cmd(queue->caravan_cmds[j].cmd);
-			}
-
-			for (j = 0; j < queue->nr_caravan_mapped; j++)
-				kunmap(queue->caravan_mapped[j]);
-
-			queue->nr_iovs = 0;
-			queue->nr_caravan_cmds = 0;
-			queue->nr_caravan_mapped = 0;
-			queue->caravan_len = 0;
-			queue->send_now = false;
+/*
+ * Push as much of a caravan as the socket accepts, starting at its
+ * cursor.  Runs of kvecs are copied with sock_sendmsg(), while iovs that
+ * have a page in bvecs (zero-copy caravans) go out through
+ * kernel_sendpage().  The skbs hold their own page references, so the
+ * commands can be put as soon as the caravan is queued.
+ * Returns 1 once the whole caravan is on the wire, 0 if the rest has
+ * to wait for write_space, or a negative errno.
+ */
+static int i10_target_push_caravan(struct i10_target_caravan *caravan)
+{
+	struct i10_target_queue *queue = caravan->queue;
+	struct kvec *iovs = caravan->iovs;
+	struct bio_vec *pages = caravan->bvecs;
+	size_t skip = caravan->sent;
+	int i = 0, n, ret;
+
+	/* Find where the previous send stopped */
+	while (i < caravan->nr_iovs && skip >= iovs[i].iov_len)
+		skip -= iovs[i++].iov_len;
+
+	while (caravan->sent < caravan->len) {
+		int flags = MSG_DONTWAIT;
+		size_t seg;
+
+		if (pages && pages[i].bv_page) {
+			n = 1;
+			seg = iovs[i].iov_len - skip;
+			if (caravan->sent + seg < caravan->len)
+				flags |= MSG_MORE | MSG_SENDPAGE_NOTLAST;
+			else
+				flags |= MSG_EOR;
+			ret = kernel_sendpage(queue->sock, pages[i].bv_page,
+					pages[i].bv_offset + skip, seg, flags);
+		} else {
+			struct msghdr msg = {};
+
+			for (n = 0, seg = 0; i + n < caravan->nr_iovs &&
+			     !(pages && pages[i + n].bv_page); n++)
+				seg += iovs[i + n].iov_len;
+			seg -= skip;
+
+			msg.msg_flags = flags |
+				(caravan->sent + seg < caravan->len ?
+				 MSG_MORE : MSG_EOR);
+			iov_iter_kvec(&msg.msg_iter, WRITE, &iovs[i], n,
+					seg + skip);
+			iov_iter_advance(&msg.msg_iter, skip);
+			ret = sock_sendmsg(queue->sock, &msg);
 		}
 
-		/* Send i10 caravans2 */
-		if ((queue->send_now2 || ret <= 0 || i == budget - 1) &&
-			queue->caravan2_len) {
-			struct msghdr msg2 =
-				{ .msg_flags = MSG_DONTWAIT | MSG_EOR };
-			int i10_ret2, j2;
-
-			if (i10_target_sndbuf_nospace(queue,
-				queue->caravan2_len)) {
-				set_bit(SOCK_NOSPACE,
-					&queue->sock->sk->sk_socket->flags);
-				return 0;
-			}
-
-			i10_ret2 = kernel_sendmsg(queue->sock, &msg2,
-					queue->caravan2_iovs,
-					queue->nr_iovs2, queue->caravan2_len);
-			if (unlikely(i10_ret2 <= 0))
-				pr_err("i10_TARGET: kernel_sendmsg fails (i10_ret %d)\n",
-					i10_ret2);
-
-			for (j2 = 0; j2 < queue->nr_caravan2_cmds; j2++) {
-				kfree(queue->caravan2_cmds[j2].cmd->iov);
-				sgl_free(queue->caravan2_cmds[j2].cmd->req.sg);
-				i10_target_put_cmd(queue->caravan2_cmds[j2].cmd);
-			}
-
-			for (j2 = 0; j2 < queue->nr_caravan2_mapped; j2++)
-				kunmap(queue->caravan2_mapped[j2]);
-
-			queue->nr_iovs2 = 0;
-			queue->nr_caravan2_cmds = 0;
-			queue->nr_caravan2_mapped = 0;
-			queue->caravan2_len = 0;
-			queue->send_now2 = false;
+		if (ret == -EAGAIN)
+			return 0;
+		if (unlikely(ret < 0)) {
+			pr_err("I10_TARGET: %s caravan send fails (ret %d)\n",
+				caravan->profile->name, ret);
+			return ret;
 		}
 
-		if (ret <= 0)
-			break;
-		(*sends)++;
+		caravan->sent += ret;
+		if (ret < seg)
+			return 0;
+		i += n;
+		skip = 0;
 	}
-	return ret;
+	return 1;
 }
 
-static void i10_target_prepare_receive_pdu(struct i10_target_queue *queue)
+static enum i10_target_flush_reason
+i10_target_flush_reason(struct i10_target_caravan *caravan)
 {
-	queue->offset = 0;
-	queue->left = sizeof(struct nvme_tcp_hdr);
-	queue->cmd = NULL;
-	queue->rcv_state = I10_TARGET_RECV_PDU;
+	if (i10_target_is_caravan_full(caravan))
+		return I10_TARGET_FLUSH_FULL;
+	if (caravan->send_now)
+		return I10_TARGET_FLUSH_NODELAY;
+	if (READ_ONCE(caravan->timer_fired))
+		return I10_TARGET_FLUSH_TIMER;
+	return I10_TARGET_FLUSH_DRAINED;
 }
 
-static void i10_target_free_crypto(struct i10_target_queue *queue)
+static inline int i10_target_stats_bucket(unsigned long v)
 {
-	struct crypto_ahash *tfm = crypto_ahash_reqtfm(queue->rcv_hash);
-
-	ahash_request_free(queue->rcv_hash);
-	ahash_request_free(queue->snd_hash);
-	crypto_free_ahash(tfm);
+	return v ? min_t(int, ilog2(v), I10_TARGET_STATS_BUCKETS - 1) : 0;
 }
 
-static int i10_target_alloc_crypto(struct i10_target_queue *queue)
+/* Account a caravan as it starts going out */
+static void i10_target_stats_flush(struct i10_target_caravan *caravan)
 {
-	struct crypto_ahash *tfm;
+	struct i10_target_caravan_stats *stats = &caravan->stats;
+	enum i10_target_flush_reason reason = i10_target_flush_reason(caravan);
 
-	tfm = crypto_alloc_ahash("crc32c", 0, CRYPTO_ALG_ASYNC);
-	if (IS_ERR(tfm))
-		return PTR_ERR(tfm);
+	trace_i10_target_caravan_flush(caravan->queue->idx,
+		caravan->profile->name, caravan->len, caravan->nr_iovs,
+		i10_target_flush_reason_names[reason], caravan->first_ns);
 
-	queue->snd_hash = ahash_request_alloc(tfm, GFP_KERNEL);
-	if (!queue->snd_hash)
-		goto free_tfm;
-	ahash_request_set_callback(queue->snd_hash, 0, NULL, NULL);
+	stats->flushes[reason]++;
+	stats->bytes[i10_target_stats_bucket(caravan->len >>
+		I10_TARGET_STATS_BYTES_SHIFT)]++;
+	stats->iovs[i10_target_stats_bucket(caravan->nr_iovs)]++;
+}
 
-	queue->rcv_hash = ahash_request_alloc(tfm, GFP_KERNEL);
-	if (!queue->rcv_hash)
-		goto free_snd_hash;
-	ahash_request_set_callback(queue->rcv_hash, 0, NULL, NULL);
+/* ... and once it is completely on the wire */
+static void i10_target_stats_sent(struct i10_target_caravan *caravan)
+{
+	struct i10_target_caravan_stats *stats = &caravan->stats;
+	u64 lat = ktime_get_ns() - caravan->first_ns;
 
-	return 0;
-free_snd_hash:
-	ahash_request_free(queue->snd_hash);
-free_tfm:
-	crypto_free_ahash(tfm);
-	return -ENOMEM;
+	stats->flush_lat_ns += lat;
+	if (lat > stats->flush_lat_max_ns)
+		stats->flush_lat_max_ns = lat;
 }
 
-
-static int i10_target_handle_icreq(struct i10_target_queue *queue)
+static int i10_target_flush_caravan(struct i10_target_caravan *caravan)
 {
-	struct nvme_tcp_icreq_pdu *icreq = &queue->pdu.icreq;
-	struct nvme_tcp_icresp_pdu *icresp = &queue->pdu.icresp;
-	struct msghdr msg = {};
-	struct kvec iov;
-	int ret;
+	int j, ret;
 
-	if (le32_to_cpu(icreq->hdr.plen) != sizeof(struct nvme_tcp_icreq_pdu)) {
-		pr_err("bad nvme-tcp pdu length (%d)\n",
+	if (!caravan->sent)
+		i10_target_stats_flush(caravan);
+
+	ret = i10_target_push_caravan(caravan);
+	if (!ret)
+		caravan->stats.nospace++;
+	if (ret <= 0)
+		return ret;
+
+	i10_target_stats_sent(caravan);
+
+	/* before nr_cmds is reset, so the event reports what went out */
+	if (hrtimer_active(&caravan->doorbell_timer)) {
+		hrtimer_cancel(&caravan->doorbell_timer);
+		caravan->stats.early_rings++;
+		trace_i10_target_doorbell_cancelled(caravan->queue->idx,
+			caravan->profile->name, caravan->nr_cmds,
+			READ_ONCE(*caravan->profile->delay_us));
+	}
+
+	for (j = 0; j < caravan->nr_cmds; j++) {
+		i10_target_free_data(caravan->cmds[j].cmd);
+		i10_target_put_cmd(caravan->cmds[j].cmd);
+	}
+
+	for (j = 0; j < caravan->nr_mapped; j++)
+		kunmap(caravan->mapped[j]);
+	if (caravan->bvecs)
+		memset(caravan->bvecs, 0,
+			caravan->nr_iovs * sizeof(*caravan->bvecs));
+
+	caravan->nr_iovs = 0;
+	caravan->nr_cmds = 0;
+	caravan->nr_mapped = 0;
+	caravan->len = 0;
+	caravan->sent = 0;
+	caravan->stage_len = 0;
+	caravan->send_now = false;
+
+	WRITE_ONCE(caravan->timer_fired, false);
+	return 1;
+}
+
+/*
+ * Whether a lane goes out now.  Once the send list runs dry (@flush) a
+ * lane with a delayed doorbell keeps its caravan open until it fills
+ * up or the doorbell timer fires, so that responses to a burst of
+ * small reads share segments.
+ */
+static bool i10_target_ring_doorbell(struct i10_target_caravan *caravan,
+		bool flush)
+{
+	struct hrtimer *timer = &caravan->doorbell_timer;
+	int delay_us;
+
+	/*
+	 * A full caravan, batch included, rings at once; flushing it cancels
+	 * a timer armed for it earlier.
+	 */
+	if (caravan->send_now || READ_ONCE(caravan->timer_fired) ||
+	    i10_target_is_caravan_full(caravan))
+		return true;
+	if (!flush)
+		return false;
+
+	delay_us = caravan->profile->delay_us ?
+			READ_ONCE(*caravan->profile->delay_us) : 0;
+	if (delay_us <= 0 ||
+	    READ_ONCE(caravan->queue->state) == I10_TARGET_Q_DISCONNECTING)
+		return true;
+
+	if (!hrtimer_active(timer)) {
+		hrtimer_start(timer, ns_to_ktime((u64)delay_us * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+		trace_i10_target_doorbell_armed(caravan->queue->idx,
+			caravan->profile->name, caravan->nr_cmds, delay_us);
+	}
+	return false;
+}
+
+static enum hrtimer_restart i10_target_doorbell_timeout(struct hrtimer *timer)
+{
+	struct i10_target_caravan *caravan =
+		container_of(timer, struct i10_target_caravan,
+			doorbell_timer);
+	struct i10_target_queue *queue = caravan->queue;
+
+	caravan->stats.timer_fires++;
+	trace_i10_target_doorbell_fired(queue->idx, caravan->profile->name,
+		caravan->nr_cmds, READ_ONCE(*caravan->profile->delay_us));
+	WRITE_ONCE(caravan->timer_fired, true);
+	i10_target_kick(queue);
+	return HRTIMER_NORESTART;
+}
+
+static void i10_target_cancel_doorbells(struct i10_target_queue *queue)
+{
+	int i;
+
+	for (i = 0; i < I10_TARGET_NR_LANES; i++)
+		hrtimer_cancel(&queue->caravans[i].doorbell_timer);
+}
+
+static int i10_target_flush_caravans(struct i10_target_queue *queue,
+		bool flush)
+{
+	int i, ret;
+
+	/*
+	 * A caravan that went out partially has to finish before any
+	 * other may start, so resume it first.
+	 */
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		if (!queue->caravans[i].sent)
+			continue;
+		ret = i10_target_flush_caravan(&queue->caravans[i]);
+		if (ret <= 0)
+			return ret;
+	}
+
+	/* Send i10 caravans, in lane priority order */
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		struct i10_target_caravan *caravan = &queue->caravans[i];
+
+		if (!caravan->len || !i10_target_ring_doorbell(caravan, flush))
+			continue;
+		ret = i10_target_flush_caravan(caravan);
+		if (ret <= 0)
+			return ret;
+	}
+	return 1;
+}
+
+static int i10_target_try_send(struct i10_target_queue *queue,
+		int budget, int *sends)
+{
+	int i, ret = 0, i10_ret;
+
+	for (i = 0; i < budget; i++) {
+		ret = i10_target_try_send_one(queue, i == budget - 1);
+
+		i10_ret = i10_target_flush_caravans(queue,
+				ret <= 0 || i == budget - 1);
+		if (i10_ret <= 0)
+			return i10_ret;
+
+		if (ret <= 0)
+			break;
+		(*sends)++;
+	}
+	return ret;
+}
+
+static void i10_target_free_caravans(struct i10_target_queue *queue)
+{
+	int i;
+
+	i10_target_cancel_doorbells(queue);
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		struct i10_target_caravan *caravan = &queue->caravans[i];
+
+		kfree(caravan->iovs);
+		kfree(caravan->cmds);
+		kfree(caravan->mapped);
+		kfree(caravan->bvecs);
+		kfree(caravan->stage);
+	}
+}
+
+static int i10_target_alloc_caravans(struct i10_target_queue *queue)
+{
+	int i;
+
+	/* Timers first, so that the error path can always cancel them */
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		hrtimer_init(&queue->caravans[i].doorbell_timer,
+				CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		queue->caravans[i].doorbell_timer.function =
+				&i10_target_doorbell_timeout;
+	}
+
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		struct i10_target_caravan *caravan = &queue->caravans[i];
+
+		caravan->queue = queue;
+		caravan->profile = &i10_target_lanes[i];
+		caravan->iovs = kcalloc(I10_TARGET_SEND_BUDGET * 3,
+				sizeof(*caravan->iovs), GFP_KERNEL);
+		caravan->cmds = kcalloc(caravan->profile->batch,
+				sizeof(*caravan->cmds), GFP_KERNEL);
+		caravan->mapped = kcalloc(I10_TARGET_SEND_BUDGET,
+				sizeof(*caravan->mapped), GFP_KERNEL);
+		caravan->stage_size = min_t(size_t, caravan->profile->capacity,
+				I10_CARAVAN_STAGE_MAX);
+		if (!caravan->iovs || !caravan->cmds || !caravan->mapped)
+			goto err_free;
+
+		if (queue->zero_copy) {
+			caravan->bvecs = kcalloc(I10_TARGET_SEND_BUDGET * 3,
+					sizeof(*caravan->bvecs), GFP_KERNEL);
+			if (!caravan->bvecs)
+				goto err_free;
+		}
+	}
+	return 0;
+
+err_free:
+	i10_target_free_caravans(queue);
+	return -ENOMEM;
+}
+
+static void i10_target_prepare_receive_pdu(struct i10_target_queue *queue)
+{
+	queue->offset = 0;
+	queue->left = sizeof(struct nvme_tcp_hdr);
+	queue->cmd = NULL;
+	queue->rcv_state = I10_TARGET_RECV_PDU;
+}
+
+static int i10_target_handle_icreq(struct i10_target_queue *queue)
+{
+	struct nvme_tcp_icreq_pdu *icreq = &queue->pdu.icreq;
+	struct nvme_tcp_icresp_pdu *icresp = &queue->pdu.icresp;
+	struct msghdr msg = {};
+	struct kvec iov;
+	int ret;
+
+	if (le32_to_cpu(icreq->hdr.plen) != sizeof(struct nvme_tcp_icreq_pdu)) {
+		pr_err("bad nvme-tcp pdu length (%d)\n",
 			le32_to_cpu(icreq->hdr.plen));
 		i10_target_fatal_error(queue);
 	}
@@ -994,11 +1766,7 @@ static int i10_target_handle_icreq(struct i10_target_queue *queue)
 
 	queue->hdr_digest = !!(icreq->digest & NVME_TCP_HDR_DIGEST_ENABLE);
 	queue->data_digest = !!(icreq->digest & NVME_TCP_DATA_DIGEST_ENABLE);
-	if (queue->hdr_digest || queue->data_digest) {
-		ret = i10_target_alloc_crypto(queue);
-		if (ret)
-			return ret;
-	}
+	i10_target_digest_get(queue);
 
 	memset(icresp, 0, sizeof(*icresp));
 	icresp->hdr.type = nvme_tcp_icresp;
@@ -1017,15 +1785,11 @@ static int i10_target_handle_icreq(struct i10_target_queue *queue)
 	iov.iov_len = sizeof(*icresp);
 	ret = kernel_sendmsg(queue->sock, &msg, &iov, 1, iov.iov_len);
 	if (ret < 0)
-		goto free_crypto;
+		return ret;
 
 	queue->state = I10_TARGET_Q_LIVE;
 	i10_target_prepare_receive_pdu(queue);
 	return 0;
-free_crypto:
-	if (queue->hdr_digest || queue->data_digest)
-		i10_target_free_crypto(queue);
-	return ret;
 }
 
 static void i10_target_handle_req_failure(struct i10_target_queue *queue,
@@ -1059,7 +1823,13 @@ static int i10_target_handle_h2c_data_pdu(struct i10_target_queue *queue)
 	struct nvme_tcp_data_pdu *data = &queue->pdu.data;
 	struct i10_target_cmd *cmd;
 
-	cmd = &queue->cmds[data->ttag];
+	if (unlikely(data->ttag >= queue->nr_cmds ||
+		     !queue->cmds[data->ttag])) {
+		pr_err("queue %d: unexpected ttag %u\n", queue->idx,
+			data->ttag);
+		return -EPROTO;
+	}
+	cmd = queue->cmds[data->ttag];
 
 	if (le32_to_cpu(data->data_offset) != cmd->rbytes_done) {
 		pr_err("ttag %u unexpected data offset %u (expected %u)\n",
@@ -1080,6 +1850,171 @@ static int i10_target_handle_h2c_data_pdu(struct i10_target_queue *queue)
 	return 0;
 }
 
+static inline bool i10_target_qos_active(struct i10_target_queue *queue)
+{
+	return static_branch_unlikely(&nvmet_qos_key) && queue->qos;
+}
+
+/*
+ * Hold an I/O command back if its host is over its QoS limits, or already
+ * has commands held on this queue so that they keep their order.  The
+ * oldest held command has qos_timer armed for when it may go, which kicks
+ * i10_target_qos_release() through io_work.
+ */
+static bool i10_target_qos_hold(struct i10_target_queue *queue,
+		struct i10_target_cmd *cmd)
+{
+	u64 wait_ns;
+
+	if (!i10_target_qos_active(queue) || !queue->nvme_sq.qid)
+		return false;
+
+	if (list_empty(&queue->qos_list)) {
+		if (nvmet_qos_admit(queue->qos, cmd->req.transfer_len,
+				&wait_ns))
+			return false;
+		hrtimer_start(&queue->qos_timer, ns_to_ktime(wait_ns),
+				HRTIMER_MODE_REL);
+	}
+	list_add_tail(&cmd->entry, &queue->qos_list);
+	queue->qos_held++;
+	return true;
+}
+
+static enum hrtimer_restart i10_target_qos_timeout(struct hrtimer *timer)
+{
+	struct i10_target_queue *queue =
+		container_of(timer, struct i10_target_queue, qos_timer);
+
+	i10_target_kick(queue);
+	return HRTIMER_NORESTART;
+}
+
+/* Called once io_work is gone for good, before the sq goes away */
+static void i10_target_qos_abort(struct i10_target_queue *queue)
+{
+	struct i10_target_cmd *cmd, *tmp;
+
+	hrtimer_cancel(&queue->qos_timer);
+	list_for_each_entry_safe(cmd, tmp, &queue->qos_list, entry) {
+		list_del_init(&cmd->entry);
+		nvmet_req_complete(&cmd->req, NVME_SC_ABORT_REQ);
+	}
+}
+
+static void i10_target_queue_exec(struct i10_target_cmd *cmd)
+{
+	struct i10_target_queue *queue = cmd->queue;
+
+	if (unlikely(queue->nr_exec == ARRAY_SIZE(queue->exec_batch))) {
+		if (!i10_target_qos_hold(queue, cmd))
+			nvmet_req_execute(&cmd->req);
+		return;
+	}
+	queue->exec_batch[queue->nr_exec++] = cmd;
+}
+
+static inline bool i10_target_exec_is_rw(struct i10_target_cmd *cmd)
+{
+	u8 opcode = cmd->req.cmd->common.opcode;
+
+	return cmd->req.ns && cmd->queue->nvme_sq.qid &&
+		(opcode == nvme_cmd_read || opcode == nvme_cmd_write);
+}
+
+static inline bool i10_target_exec_before(struct i10_target_cmd *a,
+		struct i10_target_cmd *b)
+{
+	struct nvme_rw_command *ra = &a->req.cmd->rw, *rb = &b->req.cmd->rw;
+
+	if (ra->nsid != rb->nsid)
+		return le32_to_cpu(ra->nsid) < le32_to_cpu(rb->nsid);
+	if (ra->opcode != rb->opcode)
+		return ra->opcode < rb->opcode;
+	return le64_to_cpu(ra->slba) < le64_to_cpu(rb->slba);
+}
+
+/*
+ * Put each run of reads and writes in (nsid, opcode, slba) order, so
+ * that LBA-adjacent commands of a caravan reach the plug back to back
+ * and the block layer merges their bios.  Other commands stay where
+ * they are and no read or write moves across them.
+ */
+static void i10_target_exec_sort(struct i10_target_queue *queue)
+{
+	struct i10_target_cmd **batch = queue->exec_batch;
+	int start = 0, i, j;
+
+	for (i = 0; i < queue->nr_exec; i++) {
+		struct i10_target_cmd *cmd = batch[i];
+
+		if (!i10_target_exec_is_rw(cmd)) {
+			start = i + 1;
+			continue;
+		}
+		for (j = i; j > start && i10_target_exec_before(cmd, batch[j - 1]);
+		     j--)
+			batch[j] = batch[j - 1];
+		batch[j] = cmd;
+	}
+}
+
+static inline void i10_target_exec_one(struct i10_target_queue *queue,
+		struct nvmet_req *req)
+{
+	trace_i10_target_exec(queue->idx, queue->nvme_sq.qid,
+		req->cmd->common.command_id, req->cmd->common.opcode,
+		req->transfer_len);
+	nvmet_req_execute(req);
+}
+
+/* Run the held commands that the host's QoS now admits, oldest first */
+static void i10_target_qos_release(struct i10_target_queue *queue)
+{
+	struct i10_target_cmd *cmd, *tmp;
+	u64 wait_ns;
+
+	list_for_each_entry_safe(cmd, tmp, &queue->qos_list, entry) {
+		if (!nvmet_qos_admit(queue->qos, cmd->req.transfer_len,
+				&wait_ns)) {
+			hrtimer_start(&queue->qos_timer, ns_to_ktime(wait_ns),
+					HRTIMER_MODE_REL);
+			return;
+		}
+		list_del_init(&cmd->entry);
+		i10_target_exec_one(queue, &cmd->req);
+	}
+}
+
+static void i10_target_exec_cmds(struct i10_target_queue *queue)
+{
+	bool held = !list_empty(&queue->qos_list);
+	struct blk_plug plug;
+	int i;
+
+	if (!queue->nr_exec && likely(!held))
+		return;
+
+	if (queue->nr_exec > 1 && READ_ONCE(i10_target_exec_merge))
+		i10_target_exec_sort(queue);
+
+	blk_start_plug(&plug);
+	if (unlikely(held))
+		i10_target_qos_release(queue);
+	for (i = 0; i < queue->nr_exec; i++) {
+		struct i10_target_cmd *cmd = queue->exec_batch[i];
+
+		if (i10_target_qos_hold(queue, cmd))
+			continue;
+		i10_target_exec_one(queue, &cmd->req);
+	}
+	blk_finish_plug(&plug);
+
+	queue->exec_rounds++;
+	queue->exec_cmds += queue->nr_exec;
+	queue->nr_exec = 0;
+}
+
 static int i10_target_done_recv_pdu(struct i10_target_queue *queue)
 {
 	struct nvme_tcp_hdr *hdr = &queue->pdu.cmd.hdr;
@@ -1128,6 +2063,10 @@ static int i10_target_done_recv_pdu(struct i10_target_queue *queue)
 		return -EAGAIN;
 	}
 
+	trace_i10_target_recv_cmd(queue->idx, queue->nvme_sq.qid,
+		req->cmd->common.command_id, req->cmd->common.opcode,
+		req->transfer_len);
+
 	ret = i10_target_map_data(queue->cmd);
 	if (unlikely(ret)) {
 		pr_err("queue %d: failed to map data\n", queue->idx);
@@ -1150,7 +2089,7 @@ static int i10_target_done_recv_pdu(struct i10_target_queue *queue)
 		goto out;
 	}
 
-	nvmet_req_execute(&queue->cmd->req);
+	i10_target_queue_exec(queue->cmd);
 out:
 	i10_target_prepare_receive_pdu(queue);
 	return ret;
@@ -1184,25 +2123,28 @@ static inline bool i10_target_pdu_valid(u8 type)
 	return false;
 }
 
-static int i10_target_try_recv_pdu(struct i10_target_queue *queue)
+/*
+ * Assemble a PDU header from the skb.  Returns 1 once a complete,
+ * validated PDU sits in queue->pdu.
+ */
+static int i10_target_recv_pdu(struct i10_target_queue *queue,
+		struct sk_buff *skb, unsigned int *offset, size_t *len)
 {
 	struct nvme_tcp_hdr *hdr = &queue->pdu.cmd.hdr;
-	int len;
-	struct kvec iov;
-	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
+	size_t rcv_len = min_t(size_t, *len, queue->left);
+	int ret;
 
-recv:
-	iov.iov_base = (void *)&queue->pdu + queue->offset;
-	iov.iov_len = queue->left;
-	len = kernel_recvmsg(queue->sock, &msg, &iov, 1,
-			iov.iov_len, msg.msg_flags);
-	if (unlikely(len < 0))
-		return len;
+	ret = skb_copy_bits(skb, *offset,
+		(void *)&queue->pdu + queue->offset, rcv_len);
+	if (unlikely(ret))
+		return ret;
 
-	queue->offset += len;
-	queue->left -= len;
+	queue->offset += rcv_len;
+	queue->left -= rcv_len;
+	*offset += rcv_len;
+	*len -= rcv_len;
 	if (queue->left)
-		return -EAGAIN;
+		return 0;
 
 	if (queue->offset == sizeof(struct nvme_tcp_hdr)) {
 		u8 hdgst = i10_target_hdgst_len(queue);
@@ -1219,85 +2161,99 @@ recv:
 		}
 
 		queue->left = hdr->hlen - queue->offset + hdgst;
-		goto recv;
+		return 0;
 	}
 
-	if (queue->hdr_digest &&
+	if (i10_target_hdr_digest(queue) &&
 	    i10_target_verify_hdgst(queue, &queue->pdu, queue->offset)) {
 		i10_target_fatal_error(queue); /* fatal */
 		return -EPROTO;
 	}
 
-	if (queue->data_digest &&
+	if (i10_target_data_digest(queue) &&
 	    i10_target_check_ddgst(queue, &queue->pdu)) {
 		i10_target_fatal_error(queue); /* fatal */
 		return -EPROTO;
 	}
 
-	return i10_target_done_recv_pdu(queue);
+	return 1;
 }
 
 static void i10_target_prep_recv_ddgst(struct i10_target_cmd *cmd)
 {
 	struct i10_target_queue *queue = cmd->queue;
 
-	i10_target_ddgst(queue->rcv_hash, cmd);
+	cmd->exp_ddgst = cpu_to_le32(~queue->rcv_crc);
 	queue->offset = 0;
 	queue->left = NVME_TCP_DIGEST_LENGTH;
 	queue->rcv_state = I10_TARGET_RECV_DDGST;
 }
 
-static int i10_target_try_recv_data(struct i10_target_queue *queue)
+static int i10_target_recv_data(struct i10_target_queue *queue,
+		struct sk_buff *skb, unsigned int *offset, size_t *len)
 {
-	struct i10_target_cmd  *cmd = queue->cmd;
+	struct i10_target_cmd *cmd = queue->cmd;
+	size_t rcv_len = min_t(size_t, *len, msg_data_left(&cmd->recv_msg));
 	int ret;
 
-	while (msg_data_left(&cmd->recv_msg)) {
-		ret = sock_recvmsg(cmd->queue->sock, &cmd->recv_msg,
-			cmd->recv_msg.msg_flags);
-		if (ret <= 0)
-			return ret;
+	ret = skb_copy_datagram_iter(skb, *offset,
+			&cmd->recv_msg.msg_iter, rcv_len);
+	if (unlikely(ret))
+		return ret;
 
-		cmd->pdu_recv += ret;
-		cmd->rbytes_done += ret;
-	}
+	/*
+	 * Hash straight from the skb while it is cache hot.  The host may
+	 * split one R2T into several H2C data PDUs, each with its own
+	 * digest, and rcv_crc restarts with every PDU header.
+	 */
+	if (i10_target_data_digest(queue))
+		queue->rcv_crc = (__force u32)__skb_checksum(skb, *offset,
+				rcv_len, (__force __wsum)queue->rcv_crc,
+				&i10_target_skb_crc_ops);
+
+	*offset += rcv_len;
+	*len -= rcv_len;
+	cmd->pdu_recv += rcv_len;
+	cmd->rbytes_done += rcv_len;
+	if (msg_data_left(&cmd->recv_msg))
+		return 0;
 
 	i10_target_unmap_pdu_iovec(cmd);
 
-	if (!(cmd->flags & I10_TARGET_F_INIT_FAILED) &&
-	    cmd->rbytes_done == cmd->req.transfer_len) {
-		if (queue->data_digest) {
-			i10_target_prep_recv_ddgst(cmd);
-			return 0;
-		}
-		nvmet_req_execute(&cmd->req);
+	/* Every data PDU carries its own digest */
+	if (i10_target_data_digest(queue)) {
+		i10_target_prep_recv_ddgst(cmd);
+		return 0;
 	}
 
+	if (!(cmd->flags & I10_TARGET_F_INIT_FAILED) &&
+	    cmd->rbytes_done == cmd->req.transfer_len)
+		i10_target_queue_exec(cmd);
+
 	i10_target_prepare_receive_pdu(queue);
 	return 0;
 }
 
-static int i10_target_try_recv_ddgst(struct i10_target_queue *queue)
+static int i10_target_recv_ddgst(struct i10_target_queue *queue,
+		struct sk_buff *skb, unsigned int *offset, size_t *len)
 {
 	struct i10_target_cmd *cmd = queue->cmd;
+	size_t rcv_len = min_t(size_t, *len, queue->left);
 	int ret;
-	struct msghdr msg = { .msg_flags = MSG_DONTWAIT };
-	struct kvec iov = {
-		.iov_base = (void *)&cmd->recv_ddgst + queue->offset,
-		.iov_len = queue->left
-	};
 
-	ret = kernel_recvmsg(queue->sock, &msg, &iov, 1,
-			iov.iov_len, msg.msg_flags);
-	if (unlikely(ret < 0))
+	ret = skb_copy_bits(skb, *offset,
+		(void *)&cmd->recv_ddgst + queue->offset, rcv_len);
+	if (unlikely(ret))
 		return ret;
 
-	queue->offset += ret;
-	queue->left -= ret;
+	queue->offset += rcv_len;
+	queue->left -= rcv_len;
+	*offset += rcv_len;
+	*len -= rcv_len;
 	if (queue->left)
-		return -EAGAIN;
+		return 0;
 
-	if (queue->data_digest && cmd->exp_ddgst != cmd->recv_ddgst) {
+	if (i10_target_data_digest(queue) && cmd->exp_ddgst != cmd->recv_ddgst) {
 		pr_err("queue %d: cmd %d pdu (%d) data digest error: recv %#x expected %#x\n",
 			queue->idx, cmd->req.cmd->common.command_id,
 			queue->pdu.cmd.hdr.type, le32_to_cpu(cmd->recv_ddgst),
@@ -1310,60 +2266,100 @@ static int i10_target_try_recv_ddgst(struct i10_target_queue *queue)
 
 	if (!(cmd->flags & I10_TARGET_F_INIT_FAILED) &&
 	    cmd->rbytes_done == cmd->req.transfer_len)
-		nvmet_req_execute(&cmd->req);
+		i10_target_queue_exec(cmd);
 	ret = 0;
 out:
 	i10_target_prepare_receive_pdu(queue);
 	return ret;
 }
 
-static int i10_target_try_recv_one(struct i10_target_queue *queue)
-{
-	int result;
-
-	if (unlikely(queue->rcv_state == I10_TARGET_RECV_ERR))
-		return 0;
-
-	if (queue->rcv_state == I10_TARGET_RECV_PDU) {
-		result = i10_target_try_recv_pdu(queue);
-		if (result != 0)
-			goto done_recv;
-	}
-
-	if (queue->rcv_state == I10_TARGET_RECV_DATA) {
-		result = i10_target_try_recv_data(queue);
-		if (result != 0)
-			goto done_recv;
-	}
-
-	if (queue->rcv_state == I10_TARGET_RECV_DDGST) {
-		result = i10_target_try_recv_ddgst(queue);
-		if (result != 0)
-			goto done_recv;
-	}
+/*
+ * tcp_read_sock() actor: parse as many PDUs as the skb holds while the
+ * socket stays locked.  desc->count is the PDU budget left for this
+ * round; errors are handed back through desc->error.
+ */
+static int i10_target_recv_skb(read_descriptor_t *desc, struct sk_buff *skb,
+		unsigned int offset, size_t len)
+{
+	struct i10_target_queue *queue = desc->arg.data;
+	size_t consumed = len;
+	int result = 0;
+
+	while (len && desc->count) {
+		switch (queue->rcv_state) {
+		case I10_TARGET_RECV_PDU:
+			result = i10_target_recv_pdu(queue, skb, &offset, &len);
+			if (result <= 0)
+				break;
+			desc->count--;
+			/*
+			 * The icresp goes out with kernel_sendmsg(), which
+			 * needs the socket unlocked; i10_target_try_recv()
+			 * finishes the icreq.
+			 */
+			if (unlikely(queue->state == I10_TARGET_Q_CONNECTING)) {
+				desc->count = 0;
+				result = 0;
+				break;
+			}
+			result = i10_target_done_recv_pdu(queue);
+			break;
+		case I10_TARGET_RECV_DATA:
+			result = i10_target_recv_data(queue, skb, &offset, &len);
+			break;
+		case I10_TARGET_RECV_DDGST:
+			result = i10_target_recv_ddgst(queue, skb, &offset, &len);
+			break;
+		default:
+			/* I10_TARGET_RECV_ERR: leave the rest unread */
+			desc->count = 0;
+			result = 0;
+		}
 
-done_recv:
-	if (result < 0) {
 		if (result == -EAGAIN)
-			return 0;
-		return result;
+			result = 0;
+		if (unlikely(result < 0)) {
+			desc->error = result;
+			desc->count = 0;
+		}
 	}
-	return 1;
+
+	return consumed - len;
 }
 
 static int i10_target_try_recv(struct i10_target_queue *queue,
 		int budget, int *recvs)
 {
-	int i, ret = 0;
+	struct sock *sk = queue->sock->sk;
+	read_descriptor_t rd_desc = {};
+	int consumed;
 
-	for (i = 0; i < budget; i++) {
-		ret = i10_target_try_recv_one(queue);
-		if (ret <= 0)
-			break;
-		(*recvs)++;
+	if (unlikely(queue->rcv_state == I10_TARGET_RECV_ERR))
+		return 0;
+
+	rd_desc.arg.data = queue;
+	rd_desc.count = budget;
+	lock_sock(sk);
+	consumed = tcp_read_sock(sk, &rd_desc, i10_target_recv_skb);
+	release_sock(sk);
+	*recvs += budget - rd_desc.count;
+
+	/* What was fully received still runs, even if the round failed */
+	i10_target_exec_cmds(queue);
+
+	if (unlikely(rd_desc.error))
+		return rd_desc.error;
+
+	/* A complete icreq is waiting, see i10_target_recv_skb() */
+	if (unlikely(queue->state == I10_TARGET_Q_CONNECTING) &&
+	    queue->rcv_state == I10_TARGET_RECV_PDU && !queue->left) {
+		int ret = i10_target_done_recv_pdu(queue);
+
+		if (ret < 0)
+			return ret;
 	}
 
-	return ret;
+	return consumed;
 }
 
 static void i10_target_schedule_release_queue(struct i10_target_queue *queue)
@@ -1376,16 +2372,34 @@ static void i10_target_schedule_release_queue(struct i10_target_queue *queue)
 	spin_unlock(&queue->state_lock);
 }
 
-static void i10_target_io_work(struct work_struct *w)
+/*
+ * The PDUs one io_work turn may move.  A QoS weight scales it, so that
+ * queues of different hosts sharing a CPU, on i10_target_wq or a poller,
+ * get turns, receives and caravan flushes alike, in proportion.
+ */
+static inline int i10_target_io_budget(struct i10_target_queue *queue)
 {
-	struct i10_target_queue *queue =
-		container_of(w, struct i10_target_queue, io_work);
+	if (!i10_target_qos_active(queue))
+		return I10_TARGET_IO_WORK_BUDGET;
+	return max_t(int, 1, I10_TARGET_IO_WORK_BUDGET *
+		READ_ONCE(queue->qos->weight) / NVMET_QOS_WEIGHT_DEFAULT);
+}
+
+/*
+ * One io_work turn of @queue, adding the PDUs it moved to @ops.  Returns
+ * true if the budget ran out with work still pending.
+ */
+static bool i10_target_io_run(struct i10_target_queue *queue, int *ops)
+{
+	int ret, start = *ops, budget = i10_target_io_budget(queue);
 	bool pending;
-	int ret, ops = 0;
-	
+
+	if (unlikely(READ_ONCE(queue->shrink)))
+		i10_target_shrink(queue);
+
 	do {
 		pending = false;
-		ret = i10_target_try_recv(queue, I10_TARGET_RECV_BUDGET, &ops);
+		ret = i10_target_try_recv(queue, I10_TARGET_RECV_BUDGET, ops);
 		if (ret > 0) {
 			pending = true;
 		} else if (ret < 0) {
@@ -1393,10 +2407,10 @@ static void i10_target_io_work(struct work_struct *w)
 				kernel_sock_shutdown(queue->sock, SHUT_RDWR);
 			else
 				i10_target_fatal_error(queue);
-			return;
+			return false;
 		}
 
-		ret = i10_target_try_send(queue, I10_TARGET_SEND_BUDGET, &ops);
+		ret = i10_target_try_send(queue, I10_TARGET_SEND_BUDGET, ops);
 		if (ret > 0) {
 			/* transmitted message/data */
 			pending = true;
@@ -1405,18 +2419,182 @@ static void i10_target_io_work(struct work_struct *w)
 				kernel_sock_shutdown(queue->sock, SHUT_RDWR);
 			else
 				i10_target_fatal_error(queue);
-			return;
+			return false;
 		}
 
-	} while (pending && ops < I10_TARGET_IO_WORK_BUDGET);
+	} while (pending && *ops - start < budget);
+
+	return pending;
+}
+
+static void i10_target_io_work(struct work_struct *w)
+{
+	struct i10_target_queue *queue =
+		container_of(w, struct i10_target_queue, io_work);
+	int ops = 0;
 
 	/*
 	 * We exahusted our budget, requeue our selves
 	 */
-	if (pending)
+	if (i10_target_io_run(queue, &ops))
 		queue_work_on(queue->cpu, i10_target_wq, &queue->io_work);
 }
 
+static int i10_target_poller_fn(void *data)
+{
+	struct i10_target_poller *poller = data;
+	u64 idle_start = ktime_get_ns();
+
+	while (!kthread_should_stop()) {
+		struct i10_target_queue *queue;
+		u64 now, slept;
+		int ops = 0;
+
+		/* a kick from here on makes the next sleep return at once */
+		WRITE_ONCE(poller->kicked, false);
+		smp_mb();
+
+		mutex_lock(&poller->lock);
+		queue = list_first_entry_or_null(&poller->queues,
+				struct i10_target_queue, poll_entry);
+		while (queue) {
+			if (READ_ONCE(queue->state) !=
+					I10_TARGET_Q_DISCONNECTING) {
+				poller->running = queue;
+				mutex_unlock(&poller->lock);
+
+				sk_busy_loop(queue->sock->sk, true);
+				i10_target_io_run(queue, &ops);
+
+				mutex_lock(&poller->lock);
+				poller->running = NULL;
+				wake_up(&poller->run_wait);
+			}
+			/* still listed: poller_del() waits while it runs */
+			if (list_is_last(&queue->poll_entry, &poller->queues))
+				queue = NULL;
+			else
+				queue = list_next_entry(queue, poll_entry);
+		}
+		mutex_unlock(&poller->lock);
+
+		now = ktime_get_ns();
+		if (ops) {
+			idle_start = now;
+		} else if (now - idle_start > poller->spin_ns) {
+			wait_event_interruptible(poller->wait,
+				READ_ONCE(poller->kicked) ||
+				kthread_should_stop());
+			idle_start = ktime_get_ns();
+			slept = idle_start - now;
+			if (slept < poller->spin_ns)
+				poller->spin_ns = min_t(u64, poller->spin_ns * 2,
+					8ULL * i10_target_poll_idle_us *
+					NSEC_PER_USEC);
+			else
+				poller->spin_ns = max_t(u64, poller->spin_ns / 2,
+					(u64)i10_target_poll_idle_us *
+					NSEC_PER_USEC);
+		}
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/*
+ * Points @queue at the busy-poll thread of queue->cpu, starting it if need
+ * be.  Kicks go to the thread from now on, but it only runs the queue once
+ * i10_target_poller_add() put it on its list.
+ */
+static int i10_target_poller_get(struct i10_target_queue *queue)
+{
+	struct i10_target_poller *poller = &i10_target_pollers[queue->cpu];
+	struct task_struct *task;
+
+	mutex_lock(&i10_target_poller_mutex);
+	if (!poller->task) {
+		task = kthread_create_on_node(i10_target_poller_fn, poller,
+				cpu_to_node(queue->cpu), "i10_poll/%d",
+				queue->cpu);
+		if (IS_ERR(task)) {
+			mutex_unlock(&i10_target_poller_mutex);
+			return PTR_ERR(task);
+		}
+		kthread_bind(task, queue->cpu);
+		poller->task = task;
+		wake_up_process(task);
+	}
+	mutex_unlock(&i10_target_poller_mutex);
+
+	queue->poller = poller;
+	return 0;
+}
+
+static void i10_target_poller_add(struct i10_target_queue *queue)
+{
+	struct i10_target_poller *poller = queue->poller;
+
+	mutex_lock(&poller->lock);
+	list_add_tail(&queue->poll_entry, &poller->queues);
+	mutex_unlock(&poller->lock);
+}
+
+/* After this the poller no longer runs @queue, though it may still kick it */
+static void i10_target_poller_del(struct i10_target_queue *queue)
+{
+	struct i10_target_poller *poller = queue->poller;
+
+	if (!poller)
+		return;
+
+	mutex_lock(&poller->lock);
+	while (poller->running == queue) {
+		mutex_unlock(&poller->lock);
+		wait_event(poller->run_wait,
+			READ_ONCE(poller->running) != queue);
+		mutex_lock(&poller->lock);
+	}
+	list_del_init(&queue->poll_entry);
+	mutex_unlock(&poller->lock);
+}
+
+static int i10_target_init_pollers(void)
+{
+	int cpu;
+
+	i10_target_pollers = kcalloc(nr_cpu_ids, sizeof(*i10_target_pollers),
+			GFP_KERNEL);
+	if (!i10_target_pollers)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct i10_target_poller *poller = &i10_target_pollers[cpu];
+
+		poller->cpu = cpu;
+		mutex_init(&poller->lock);
+		INIT_LIST_HEAD(&poller->queues);
+		init_waitqueue_head(&poller->run_wait);
+		init_waitqueue_head(&poller->wait);
+		poller->spin_ns = (u64)i10_target_poll_idle_us * NSEC_PER_USEC;
+	}
+	return 0;
+}
+
+static void i10_target_stop_pollers(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct i10_target_poller *poller = &i10_target_pollers[cpu];
+
+		if (poller->task)
+			kthread_stop(poller->task);
+		WARN_ON_ONCE(!list_empty(&poller->queues));
+	}
+	kfree(i10_target_pollers);
+}
+
 static int i10_target_alloc_cmd(struct i10_target_queue *queue,
 		struct i10_target_cmd *c)
 {
@@ -1447,6 +2625,20 @@ static int i10_target_alloc_cmd(struct i10_target_queue *queue,
 	if (!c->r2t_pdu)
 		goto out_free_data;
 
+	if (queue->pool_cmd_pages && c != &queue->connect) {
+		c->pool_sg = kmalloc_array(queue->pool_cmd_pages,
+				sizeof(*c->pool_sg), GFP_KERNEL);
+		c->pool_iov = kmalloc_array(queue->pool_cmd_pages,
+				sizeof(*c->pool_iov), GFP_KERNEL);
+		/* without them the command just does not use the pool */
+		if (!c->pool_sg || !c->pool_iov) {
+			kfree(c->pool_sg);
+			kfree(c->pool_iov);
+			c->pool_sg = NULL;
+			c->pool_iov = NULL;
+		}
+	}
+
 	c->recv_msg.msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
 
 	list_add_tail(&c->entry, &queue->free_list);
@@ -1463,48 +2655,136 @@ out_free_cmd:
 
 static void i10_target_free_cmd(struct i10_target_cmd *c)
 {
+	put_device(c->req.p2p_client);	/* the connect command's */
+	kfree(c->pool_iov);
+	kfree(c->pool_sg);
 	page_frag_free(c->r2t_pdu);
 	page_frag_free(c->data_pdu);
 	page_frag_free(c->rsp_pdu);
 	page_frag_free(c->cmd_pdu);
 }
 
-static int i10_target_alloc_cmds(struct i10_target_queue *queue)
+/*
+ * Command contexts come from a slab shared by all queues the first time
+ * a queue runs out of free ones, rather than nr_cmds of them up front,
+ * so that an idle connection costs little more than its socket.  The
+ * tag of a new command is the first unused one.
+ */
+static struct i10_target_cmd *i10_target_new_cmd(struct i10_target_queue *queue)
 {
-	struct i10_target_cmd *cmds;
-	int i, ret = -EINVAL, nr_cmds = queue->nr_cmds;
+	struct i10_target_cmd *cmd;
+	int tag;
 
-	cmds = kcalloc(nr_cmds, sizeof(struct i10_target_cmd), GFP_KERNEL);
-	if (!cmds)
-		goto out;
+	if (queue->nr_alloc_cmds >= queue->nr_cmds)
+		return NULL;
 
-	for (i = 0; i < nr_cmds; i++) {
-		ret = i10_target_alloc_cmd(queue, cmds + i);
-		if (ret)
-			goto out_free;
+	for (tag = 0; queue->cmds[tag]; tag++)
+		;
+
+	cmd = kmem_cache_zalloc(i10_target_cmd_cache, GFP_KERNEL);
+	if (!cmd)
+		return NULL;
+	cmd->tag = tag;
+	if (i10_target_alloc_cmd(queue, cmd)) {
+		kmem_cache_free(i10_target_cmd_cache, cmd);
+		return NULL;
 	}
 
-	queue->cmds = cmds;
+	queue->cmds[tag] = cmd;
+	queue->nr_alloc_cmds++;
+	queue->nr_free_cmds++;
+	return cmd;
+}
+
+static void i10_target_del_cmd(struct i10_target_cmd *cmd)
+{
+	struct i10_target_queue *queue = cmd->queue;
 
+	queue->cmds[cmd->tag] = NULL;
+	queue->nr_alloc_cmds--;
+	i10_target_free_cmd(cmd);
+	kmem_cache_free(i10_target_cmd_cache, cmd);
+}
+
+static int i10_target_alloc_cmds(struct i10_target_queue *queue)
+{
+	queue->cmds = kcalloc(queue->nr_cmds, sizeof(*queue->cmds),
+			GFP_KERNEL);
+	if (!queue->cmds)
+		return -ENOMEM;
+
+	i10_target_init_pool(queue);
 	return 0;
-out_free:
-	while (--i >= 0)
-		i10_target_free_cmd(cmds + i);
-	kfree(cmds);
-out:
-	return ret;
 }
 
 static void i10_target_free_cmds(struct i10_target_queue *queue)
 {
-	struct i10_target_cmd *cmds = queue->cmds;
 	int i;
 
-	for (i = 0; i < queue->nr_cmds; i++)
-		i10_target_free_cmd(cmds + i);
+	for (i = 0; queue->cmds && i < queue->nr_cmds; i++)
+		if (queue->cmds[i])
+			i10_target_del_cmd(queue->cmds[i]);
 
 	i10_target_free_cmd(&queue->connect);
-	kfree(cmds);
+	kfree(queue->cmds);
+	i10_target_pool_trim(queue, queue->nr_pool);
+}
+
+/*
+ * Give back what the queue has not needed since the last shrink: free
+ * commands beyond I10_TARGET_CMDS_RESERVE, pool pages and unused staging
+ * buffers.  i10_target_shrink_work asks every live queue to do this each
+ * I10_TARGET_SHRINK_INTERVAL, and the queue does it from io_work, which
+ * owns all of it.
+ */
+static void i10_target_shrink(struct i10_target_queue *queue)
+{
+	int i, nr = queue->free_low - I10_TARGET_CMDS_RESERVE;
+
+	WRITE_ONCE(queue->shrink, false);
+
+	while (nr-- > 0) {
+		struct i10_target_cmd *cmd = list_last_entry(&queue->free_list,
+				struct i10_target_cmd, entry);
+
+		list_del_init(&cmd->entry);
+		queue->nr_free_cmds--;
+		i10_target_del_cmd(cmd);
+	}
+	queue->free_low = queue->nr_free_cmds;
+
+	i10_target_pool_trim(queue, queue->pool_low);
+	queue->pool_low = queue->nr_pool;
+
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		struct i10_target_caravan *caravan = &queue->caravans[i];
+
+		if (!caravan->stage_used && !caravan->len) {
+			kfree(caravan->stage);
+			caravan->stage = NULL;
+		}
+		caravan->stage_used = false;
+	}
+}
+
+static void i10_target_shrink_timeout(struct work_struct *w);
+static DECLARE_DELAYED_WORK(i10_target_shrink_work, i10_target_shrink_timeout);
+
+static void i10_target_shrink_timeout(struct work_struct *w)
+{
+	struct i10_target_queue *queue;
+
+	mutex_lock(&i10_target_queue_mutex);
+	list_for_each_entry(queue, &i10_target_queue_list, queue_list) {
+		if (READ_ONCE(queue->state) != I10_TARGET_Q_LIVE)
+			continue;
+		WRITE_ONCE(queue->shrink, true);
+		i10_target_kick(queue);
+	}
+	mutex_unlock(&i10_target_queue_mutex);
+
+	schedule_delayed_work(&i10_target_shrink_work,
+			I10_TARGET_SHRINK_INTERVAL);
 }
 
 static void i10_target_restore_socket_callbacks(struct i10_target_queue *queue)
@@ -1523,16 +2803,17 @@ static void i10_target_finish_cmd(struct i10_target_cmd *cmd)
 {
 	nvmet_req_uninit(&cmd->req);
 	i10_target_unmap_pdu_iovec(cmd);
-	sgl_free(cmd->req.sg);
+	i10_target_free_data(cmd);
 }
 
 static void i10_target_uninit_data_in_cmds(struct i10_target_queue *queue)
 {
-	struct i10_target_cmd *cmd = queue->cmds;
 	int i;
 
-	for (i = 0; i < queue->nr_cmds; i++, cmd++) {
-		if (i10_target_need_data_in(cmd))
+	for (i = 0; i < queue->nr_cmds; i++) {
+		struct i10_target_cmd *cmd = queue->cmds[i];
+
+		if (cmd && i10_target_need_data_in(cmd))
 			i10_target_finish_cmd(cmd);
 	}
 
@@ -1542,6 +2823,148 @@ static void i10_target_uninit_data_in_cmds(struct i10_target_queue *queue)
 	}
 }
 
+static void i10_target_show_hist(struct seq_file *m, const char *name,
+		const u64 *hist, unsigned int shift)
+{
+	int i;
+
+	seq_printf(m, "  %s:", name);
+	for (i = 0; i < I10_TARGET_STATS_BUCKETS; i++)
+		seq_printf(m, " %lu:%llu", i ? 1UL << (i + shift) : 0,
+			READ_ONCE(hist[i]));
+	seq_putc(m, '\n');
+}
+
+/*
+ * What a queue holds right now, in bytes: the queue itself, its command
+ * contexts with their PDUs and pool arrays, pool pages, the caravans'
+ * arrays and staging buffers, and what sits in the socket.
+ */
+static size_t i10_target_queue_mem(struct i10_target_queue *queue)
+{
+	u8 hdgst = i10_target_hdgst_len(queue);
+	size_t cmd, mem = sizeof(*queue);
+	int i;
+
+	cmd = kmem_cache_size(i10_target_cmd_cache) + 4 * hdgst +
+		sizeof(struct nvme_tcp_cmd_pdu) +
+		sizeof(struct nvme_tcp_rsp_pdu) +
+		sizeof(struct nvme_tcp_data_pdu) +
+		sizeof(struct nvme_tcp_r2t_pdu) +
+		queue->pool_cmd_pages *
+			(sizeof(struct scatterlist) + sizeof(struct kvec));
+	mem += READ_ONCE(queue->nr_alloc_cmds) * cmd;
+	mem += queue->nr_cmds * sizeof(*queue->cmds);
+	mem += (size_t)READ_ONCE(queue->pool_size) * PAGE_SIZE;
+
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		struct i10_target_caravan *caravan = &queue->caravans[i];
+
+		mem += I10_TARGET_SEND_BUDGET * 3 * sizeof(*caravan->iovs) +
+			caravan->profile->batch * sizeof(*caravan->cmds) +
+			I10_TARGET_SEND_BUDGET * sizeof(*caravan->mapped);
+		if (caravan->bvecs)
+			mem += I10_TARGET_SEND_BUDGET * 3 *
+				sizeof(*caravan->bvecs);
+		if (READ_ONCE(caravan->stage))
+			mem += caravan->stage_size;
+	}
+
+	mem += READ_ONCE(queue->sock->sk->sk_wmem_queued) +
+		atomic_read(&queue->sock->sk->sk_rmem_alloc);
+	return mem;
+}
+
+static int i10_target_stats_show(struct seq_file *m, void *unused)
+{
+	struct i10_target_queue *queue = m->private;
+	int i, j;
+
+	for (i = 0; i < I10_TARGET_NR_LANES; i++) {
+		struct i10_target_caravan_stats *stats =
+			&queue->caravans[i].stats;
+		u64 nr = 0;
+
+		seq_printf(m, "%s:\n  flushes:", i10_target_lanes[i].name);
+		for (j = 0; j < I10_TARGET_NR_FLUSH_REASONS; j++) {
+			nr += READ_ONCE(stats->flushes[j]);
+			seq_printf(m, " %s %llu",
+				i10_target_flush_reason_names[j],
+				READ_ONCE(stats->flushes[j]));
+		}
+		seq_printf(m, "\n  timer_fires %llu early_rings %llu nospace %llu staged %llu\n",
+			READ_ONCE(stats->timer_fires),
+			READ_ONCE(stats->early_rings),
+			READ_ONCE(stats->nospace),
+			READ_ONCE(stats->staged));
+		seq_printf(m, "  flush_lat_ns avg %llu max %llu\n",
+			nr ? div64_u64(READ_ONCE(stats->flush_lat_ns), nr) : 0,
+			READ_ONCE(stats->flush_lat_max_ns));
+		i10_target_show_hist(m, "bytes", stats->bytes,
+			I10_TARGET_STATS_BYTES_SHIFT);
+		i10_target_show_hist(m, "iovs", stats->iovs, 0);
+	}
+	seq_printf(m, "pool: hits %llu misses %llu free %d/%d\n",
+		READ_ONCE(queue->pool_hits), READ_ONCE(queue->pool_misses),
+		READ_ONCE(queue->nr_pool), READ_ONCE(queue->pool_size));
+	seq_printf(m, "p2p: cmds %llu\n", READ_ONCE(queue->p2p_cmds));
+	seq_printf(m, "exec: rounds %llu cmds %llu\n",
+		READ_ONCE(queue->exec_rounds), READ_ONCE(queue->exec_cmds));
+	seq_printf(m, "qos: held %llu\n", READ_ONCE(queue->qos_held));
+	seq_printf(m, "mem: bytes %zu cmds %d/%d pool_pages %d\n",
+		i10_target_queue_mem(queue), READ_ONCE(queue->nr_alloc_cmds),
+		queue->nr_cmds, READ_ONCE(queue->pool_size));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(i10_target_stats);
+
+static int i10_target_mem_show(struct seq_file *m, void *unused)
+{
+	struct i10_target_queue *queue;
+	size_t total = 0;
+	int nr = 0;
+
+	mutex_lock(&i10_target_queue_mutex);
+	list_for_each_entry(queue, &i10_target_queue_list, queue_list) {
+		if (READ_ONCE(queue->state) != I10_TARGET_Q_LIVE)
+			continue;
+		total += i10_target_queue_mem(queue);
+		nr++;
+	}
+	mutex_unlock(&i10_target_queue_mutex);
+
+	seq_printf(m, "queues %d bytes %zu per_queue %zu\n",
+		nr, total, nr ? total / nr : 0);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(i10_target_mem);
+
+static void i10_target_debugfs_init(void)
+{
+	i10_target_debugfs_root = debugfs_create_dir("i10_target", NULL);
+	if (IS_ERR_OR_NULL(i10_target_debugfs_root))
+		return;
+
+	debugfs_create_file("mem", 0444, i10_target_debugfs_root, NULL,
+			&i10_target_mem_fops);
+}
+
+static void i10_target_debugfs_init_queue(struct i10_target_queue *queue)
+{
+	char name[16];
+
+	if (IS_ERR_OR_NULL(i10_target_debugfs_root))
+		return;
+
+	snprintf(name, sizeof(name), "queue%d", queue->idx);
+	queue->debugfs_dir = debugfs_create_dir(name, i10_target_debugfs_root);
+	if (IS_ERR_OR_NULL(queue->debugfs_dir))
+		return;
+
+	debugfs_create_file("stats", 0444, queue->debugfs_dir, queue,
+			&i10_target_stats_fops);
+}
+
 static void i10_target_release_queue_work(struct work_struct *w)
 {
 	struct i10_target_queue *queue =
@@ -1551,24 +2974,24 @@ static void i10_target_release_queue_work(struct work_struct *w)
 	list_del_init(&queue->queue_list);
 	mutex_unlock(&i10_target_queue_mutex);
 
+	debugfs_remove_recursive(queue->debugfs_dir);
 	i10_target_restore_socket_callbacks(queue);
+	i10_target_poller_del(queue);
 	flush_work(&queue->io_work);
 
+	i10_target_qos_abort(queue);
 	i10_target_uninit_data_in_cmds(queue);
 	nvmet_sq_destroy(&queue->nvme_sq);
 	cancel_work_sync(&queue->io_work);
+	/* a doorbell timer armed before we got here may kick io_work once */
+	i10_target_cancel_doorbells(queue);
+	cancel_work_sync(&queue->io_work);
 	sock_release(queue->sock);
 	i10_target_free_cmds(queue);
-	if (queue->hdr_digest || queue->data_digest)
-		i10_target_free_crypto(queue);
+	i10_target_digest_put(queue);
 	ida_simple_remove(&i10_target_queue_ida, queue->idx);
 
-	kfree(queue->caravan_iovs);
-	kfree(queue->caravan_cmds);
-	kfree(queue->caravan_mapped);
-	kfree(queue->caravan2_iovs);
-	kfree(queue->caravan2_cmds);
-	kfree(queue->caravan2_mapped);
+	i10_target_free_caravans(queue);
 	kfree(queue);
 }
 
@@ -1579,7 +3002,7 @@ static void i10_target_data_ready(struct sock *sk)
 	read_lock_bh(&sk->sk_callback_lock);
 	queue = sk->sk_user_data;
 	if (likely(queue))
-		queue_work_on(queue->cpu, i10_target_wq, &queue->io_work);
+		i10_target_kick(queue);
 	read_unlock_bh(&sk->sk_callback_lock);
 }
 
@@ -1599,7 +3022,7 @@ static void i10_target_write_space(struct sock *sk)
 
 	if (sk_stream_is_writeable(sk)) {
 		clear_bit(SOCK_NOSPACE, &sk->sk_socket->flags);
-		queue_work_on(queue->cpu, i10_target_wq, &queue->io_work);
+		i10_target_kick(queue);
 	}
 out:
 	read_unlock_bh(&sk->sk_callback_lock);
@@ -1669,6 +3092,54 @@ static int i10_target_set_queue_sock(struct i10_target_queue *queue)
 	return 0;
 }
 
+static bool i10_target_cpu_taken(struct i10_target_port *port, int cpu)
+{
+	struct i10_target_queue *queue;
+	bool taken = false;
+
+	mutex_lock(&i10_target_queue_mutex);
+	list_for_each_entry(queue, &i10_target_queue_list, queue_list) {
+		if (queue->port == port && queue->cpu == cpu) {
+			taken = true;
+			break;
+		}
+	}
+	mutex_unlock(&i10_target_queue_mutex);
+
+	return taken;
+}
+
+/*
+ * An explicit port io_cpus list wins.  Otherwise stay on the CPU that
+ * took the connection's RX softirq (the NIC queue's IRQ/RSS target)
+ * and spread any collisions over that CPU's NUMA node.
+ */
+static int i10_target_select_cpu(struct i10_target_queue *queue)
+{
+	struct i10_target_port *port = queue->port;
+	const struct cpumask *mask = &port->nport->io_cpus;
+	int cpu = READ_ONCE(queue->sock->sk->sk_incoming_cpu);
+
+	if (!cpumask_intersects(mask, cpu_online_mask)) {
+		if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu)) {
+			if (!i10_target_cpu_taken(port, cpu))
+				return cpu;
+			mask = cpumask_of_node(cpu_to_node(cpu));
+		} else {
+			mask = cpu_online_mask;
+		}
+	}
+
+	cpu = cpumask_next_and(port->last_cpu, mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first_and(mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_online_mask);
+	port->last_cpu = cpu;
+
+	return cpu;
+}
+
 static int i10_target_alloc_queue(struct i10_target_port *port,
 		struct socket *newsock)
 {
@@ -1681,6 +3152,7 @@ static int i10_target_alloc_queue(struct i10_target_port *port,
 
 	INIT_WORK(&queue->release_work, i10_target_release_queue_work);
 	INIT_WORK(&queue->io_work, i10_target_io_work);
+	INIT_LIST_HEAD(&queue->poll_entry);
 	queue->sock = newsock;
 	queue->port = port;
 	queue->nr_cmds = 0;
@@ -1689,109 +3161,69 @@ static int i10_target_alloc_queue(struct i10_target_port *port,
 	INIT_LIST_HEAD(&queue->free_list);
 	init_llist_head(&queue->resp_list);
 	INIT_LIST_HEAD(&queue->resp_send_list);
-
-	/* initiate i10 caravan */
-	queue->caravan_iovs = kcalloc(I10_TARGET_SEND_BUDGET * 3,
-				sizeof(*queue->caravan_iovs), GFP_KERNEL);
-	if (!queue->caravan_iovs) {
-		ret = -ENOMEM;
+	INIT_LIST_HEAD(&queue->qos_list);
+	INIT_LIST_HEAD(&queue->pool);
+	hrtimer_init(&queue->qos_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	queue->qos_timer.function = &i10_target_qos_timeout;
+
+	/* initiate i10 caravans */
+	queue->zero_copy = port->nport->zero_copy;
+	ret = i10_target_alloc_caravans(queue);
+	if (ret)
 		goto out_free_queue;
-	}
-	queue->caravan_cmds = kcalloc(I10_TARGET_SEND_BUDGET,
-				sizeof(*queue->caravan_cmds), GFP_KERNEL);
-	if (!queue->caravan_cmds) {
-		ret = -ENOMEM;
-		goto out_free_iovs;
-	}
-	queue->caravan_mapped = kcalloc(I10_TARGET_SEND_BUDGET,
-				sizeof(*queue->caravan_mapped), GFP_KERNEL);
-	if (!queue->caravan_mapped) {
-		ret = -ENOMEM;
-		goto out_free_cmds;
-	}
-	queue->nr_iovs = 0;
-	queue->nr_caravan_cmds = 0;
-	queue->nr_caravan_mapped = 0;
-	queue->caravan_len = 0;
-	queue->send_now = false;
-
-	/* initiate i10 caravan2 */
-	queue->caravan2_iovs = kcalloc(I10_TARGET_SEND_BUDGET * 3,
-				sizeof(*queue->caravan2_iovs), GFP_KERNEL);
-	if (!queue->caravan2_iovs) {
-		ret = -ENOMEM;
-		goto out_free_mapped;
-	}
-	queue->caravan2_cmds = kcalloc(I10_TARGET_SEND_BUDGET,
-				sizeof(*queue->caravan2_cmds), GFP_KERNEL);
-	if (!queue->caravan2_cmds) {
-		ret = -ENOMEM;
-		goto out_free_iovs2;
-	}
-	queue->caravan2_mapped = kcalloc(I10_TARGET_SEND_BUDGET,
-				sizeof(*queue->caravan2_mapped), GFP_KERNEL);
-	if (!queue->caravan2_mapped) {
-		ret = -ENOMEM;
-		goto out_free_cmds2;
-	}
-	queue->nr_iovs2 = 0;
-	queue->nr_caravan2_cmds = 0;
-	queue->nr_caravan2_mapped = 0;
-	queue->caravan2_len = 0;
-	queue->send_now2 = false;
 
 	queue->idx = ida_simple_get(&i10_target_queue_ida, 0, 0, GFP_KERNEL);
 	if (queue->idx < 0) {
 		ret = queue->idx;
-		goto out_free_mapped2;
+		goto out_free_caravans;
 	}
 
 	ret = i10_target_alloc_cmd(queue, &queue->connect);
 	if (ret)
 		goto out_ida_remove;
+	queue->connect.req.p2p_client = i10_target_p2p_client(queue);
 
 	ret = nvmet_sq_init(&queue->nvme_sq);
 	if (ret)
 		goto out_free_connect;
 
-	port->last_cpu = cpumask_next_wrap(port->last_cpu,
-				cpu_online_mask, -1, false);
-	queue->cpu = port->last_cpu;
+	queue->cpu = i10_target_select_cpu(queue);
 	i10_target_prepare_receive_pdu(queue);
+	i10_target_debugfs_init_queue(queue);
 
 	mutex_lock(&i10_target_queue_mutex);
 	list_add_tail(&queue->queue_list, &i10_target_queue_list);
 	mutex_unlock(&i10_target_queue_mutex);
 
+	if (port->nport->busy_poll) {
+		ret = i10_target_poller_get(queue);
+		if (ret)
+			goto out_destroy_sq;
+	}
+
 	ret = i10_target_set_queue_sock(queue);
 	if (ret)
 		goto out_destroy_sq;
 
-	queue_work_on(queue->cpu, i10_target_wq, &queue->io_work);
+	if (queue->poller)
+		i10_target_poller_add(queue);
+	i10_target_kick(queue);
 
 	return 0;
 out_destroy_sq:
 	mutex_lock(&i10_target_queue_mutex);
 	list_del_init(&queue->queue_list);
 	mutex_unlock(&i10_target_queue_mutex);
+	debugfs_remove_recursive(queue->debugfs_dir);
+	i10_target_poller_del(queue);
 	nvmet_sq_destroy(&queue->nvme_sq);
 out_free_connect:
 	i10_target_free_cmd(&queue->connect);
 out_ida_remove:
 	ida_simple_remove(&i10_target_queue_ida, queue->idx);
 
-out_free_mapped2:
-	kfree(queue->caravan2_mapped);
-out_free_cmds2:
-	kfree(queue->caravan2_cmds);
-out_free_iovs2:
-	kfree(queue->caravan2_iovs);
-out_free_mapped:
-	kfree(queue->caravan_mapped);
-out_free_cmds:
-	kfree(queue->caravan_cmds);
-out_free_iovs:
-	kfree(queue->caravan_iovs);
+out_free_caravans:
+	i10_target_free_caravans(queue);
 out_free_queue:
 	kfree(queue);
 	return ret;
@@ -1869,8 +3301,15 @@ static int i10_target_add_port(struct nvmet_port *nport)
 	port->nport = nport;
 	port->last_cpu = -1;
 	INIT_WORK(&port->accept_work, i10_target_accept_work);
-	if (port->nport->inline_data_size < 0)
+	if (port->nport->inline_data_size < 0) {
 		port->nport->inline_data_size = I10_TARGET_DEF_INLINE_DATA_SIZE;
+	} else if (port->nport->inline_data_size >
+			I10_TARGET_MAX_INLINE_DATA_SIZE) {
+		pr_warn("inline_data_size %u is too large, reducing to %u\n",
+			port->nport->inline_data_size,
+			I10_TARGET_MAX_INLINE_DATA_SIZE);
+		port->nport->inline_data_size = I10_TARGET_MAX_INLINE_DATA_SIZE;
+	}
 
 	ret = sock_create(port->addr.ss_family, SOCK_STREAM,
 				IPPROTO_TCP, &port->sock);
@@ -1898,20 +3337,28 @@ static int i10_target_add_port(struct nvmet_port *nport)
 		goto err_sock;
 	}
 
-	/* Set a fixed size of sndbuf/rcvbuf (8MB) */
-	opt = 8388608;
-	ret = kernel_setsockopt(port->sock, SOL_SOCKET, SO_RCVBUFFORCE,
-			(char *)&opt, sizeof(opt));
-	if (ret) {
-		pr_err("failed to set SO_RCVBUFFORCE sock opt %d\n", ret);
-		goto err_sock;
-	}
+	/*
+	 * A fixed sndbuf/rcvbuf, inherited by every accepted socket, pins
+	 * that much for each connection whether it is busy or not, so by
+	 * default TCP sizes them itself, within tcp_wmem and tcp_rmem.
+	 */
+	opt = READ_ONCE(i10_target_sockbuf_size);
+	if (opt > 0) {
+		ret = kernel_setsockopt(port->sock, SOL_SOCKET,
+				SO_RCVBUFFORCE, (char *)&opt, sizeof(opt));
+		if (ret) {
+			pr_err("failed to set SO_RCVBUFFORCE sock opt %d\n",
+				ret);
+			goto err_sock;
+		}
 
-	ret = kernel_setsockopt(port->sock, SOL_SOCKET, SO_SNDBUFFORCE,
-			(char *)&opt, sizeof(opt));
-	if (ret) {
-		pr_err("failed to set SO_SNDBUFFORCE sock opt %d\n", ret);
-		goto err_sock;
+		ret = kernel_setsockopt(port->sock, SOL_SOCKET,
+				SO_SNDBUFFORCE, (char *)&opt, sizeof(opt));
+		if (ret) {
+			pr_err("failed to set SO_SNDBUFFORCE sock opt %d\n",
+				ret);
+			goto err_sock;
+		}
 	}
 
 	ret = kernel_bind(port->sock, (struct sockaddr *)&port->addr,
@@ -1976,8 +3423,11 @@ static u16 i10_target_install_queue(struct nvmet_sq *sq)
 	}
 
 	queue->nr_cmds = sq->size * 2;
-	if (i10_target_alloc_cmds(queue))
+	if (i10_target_alloc_cmds(queue)) {
+		queue->nr_cmds = 0;
 		return NVME_SC_INTERNAL;
+	}
+	queue->qos = sq->ctrl->qos;
 	return 0;
 }
 
@@ -2018,12 +3468,31 @@ static int __init i10_target_init(void)
 	if (!i10_target_wq)
 		return -ENOMEM;
 
+	i10_target_cmd_cache = KMEM_CACHE(i10_target_cmd, SLAB_HWCACHE_ALIGN);
+	if (!i10_target_cmd_cache) {
+		ret = -ENOMEM;
+		goto err_wq;
+	}
+
+	ret = i10_target_init_pollers();
+	if (ret)
+		goto err_cache;
+
+	i10_target_debugfs_init();
+
 	ret = nvmet_register_transport(&i10_target_ops);
 	if (ret)
 		goto err;
 
+	schedule_delayed_work(&i10_target_shrink_work,
+			I10_TARGET_SHRINK_INTERVAL);
 	return 0;
 err:
+	debugfs_remove_recursive(i10_target_debugfs_root);
+	i10_target_stop_pollers();
+err_cache:
+	kmem_cache_destroy(i10_target_cmd_cache);
+err_wq:
 	destroy_workqueue(i10_target_wq);
 	return ret;
 }
@@ -2033,6 +3502,7 @@ static void __exit i10_target_exit(void)
 	struct i10_target_queue *queue;
 
 	nvmet_unregister_transport(&i10_target_ops);
+	cancel_delayed_work_sync(&i10_target_shrink_work);
 
 	flush_scheduled_work();
 	mutex_lock(&i10_target_queue_mutex);
@@ -2041,7 +3511,10 @@ static void __exit i10_target_exit(void)
 	mutex_unlock(&i10_target_queue_mutex);
 	flush_scheduled_work();
 
+	i10_target_stop_pollers();
 	destroy_workqueue(i10_target_wq);
+	debugfs_remove_recursive(i10_target_debugfs_root);
+	kmem_cache_destroy(i10_target_cmd_cache);
 }
 
 module_init(i10_target_init);
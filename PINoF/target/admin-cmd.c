@@ -545,7 +545,9 @@ static u16 nvmet_write_protect_flush_sync(struct nvmet_req *req)
 {
 	u16 status;
 
-	if (req->ns->file)
+	if (req->ns->mem)
+		status = nvmet_mem_flush(req);
+	else if (req->ns->file)
 		status = nvmet_file_flush(req);
 	else
 		status = nvmet_bdev_flush(req);
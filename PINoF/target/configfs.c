@@ -28,6 +28,9 @@ static const struct config_item_type nvmet_subsys_type;
 static LIST_HEAD(nvmet_ports_list);
 struct list_head *nvmet_ports = &nvmet_ports_list;
 
+/* Protected by nvmet_config_sem */
+static LIST_HEAD(nvmet_hosts_list);
+
 static const struct nvmet_transport_name {
 	u8		type;
 	const char	*name;
@@ -257,6 +260,94 @@ static ssize_t nvmet_param_inline_data_size_store(struct config_item *item,
 
 CONFIGFS_ATTR(nvmet_, param_inline_data_size);
 
+static ssize_t nvmet_param_zero_copy_show(struct config_item *item,
+		char *page)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+
+	return snprintf(page, PAGE_SIZE, "%d\n", port->zero_copy);
+}
+
+static ssize_t nvmet_param_zero_copy_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+	bool zero_copy;
+
+	if (port->enabled) {
+		pr_err("Cannot modify zero_copy while port enabled\n");
+		pr_err("Disable the port before modifying\n");
+		return -EACCES;
+	}
+	if (strtobool(page, &zero_copy)) {
+		pr_err("Invalid value '%s' for zero_copy\n", page);
+		return -EINVAL;
+	}
+	port->zero_copy = zero_copy;
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_, param_zero_copy);
+
+static ssize_t nvmet_param_io_cpus_show(struct config_item *item,
+		char *page)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+
+	return snprintf(page, PAGE_SIZE, "%*pbl\n",
+			cpumask_pr_args(&port->io_cpus));
+}
+
+static ssize_t nvmet_param_io_cpus_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+	int ret;
+
+	if (port->enabled) {
+		pr_err("Cannot modify io_cpus while port enabled\n");
+		pr_err("Disable the port before modifying\n");
+		return -EACCES;
+	}
+	ret = cpulist_parse(page, &port->io_cpus);
+	if (ret) {
+		pr_err("Invalid value '%s' for io_cpus\n", page);
+		return -EINVAL;
+	}
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_, param_io_cpus);
+
+static ssize_t nvmet_param_busy_poll_show(struct config_item *item,
+		char *page)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+
+	return snprintf(page, PAGE_SIZE, "%d\n", port->busy_poll);
+}
+
+static ssize_t nvmet_param_busy_poll_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+	bool busy_poll;
+
+	if (port->enabled) {
+		pr_err("Cannot modify busy_poll while port enabled\n");
+		pr_err("Disable the port before modifying\n");
+		return -EACCES;
+	}
+	if (strtobool(page, &busy_poll)) {
+		pr_err("Invalid value '%s' for busy_poll\n", page);
+		return -EINVAL;
+	}
+	port->busy_poll = busy_poll;
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_, param_busy_poll);
+
 static ssize_t nvmet_addr_trtype_show(struct config_item *item,
 		char *page)
 {
@@ -1167,6 +1258,9 @@ static struct configfs_attribute *nvmet_port_attrs[] = {
 	&nvmet_attr_addr_trsvcid,
 	&nvmet_attr_addr_trtype,
 	&nvmet_attr_param_inline_data_size,
+	&nvmet_attr_param_zero_copy,
+	&nvmet_attr_param_io_cpus,
+	&nvmet_attr_param_busy_poll,
 	NULL,
 };
 
@@ -1254,10 +1348,120 @@ static const struct config_item_type nvmet_ports_type = {
 static struct config_group nvmet_subsystems_group;
 static struct config_group nvmet_ports_group;
 
+/*
+ * QoS of the host named @hostnqn, with a reference for a new controller,
+ * or NULL if there is no such host.  nvmet_config_sem must be held.
+ */
+struct nvmet_qos *nvmet_host_qos_get(const char *hostnqn)
+{
+	struct nvmet_host *host;
+
+	lockdep_assert_held(&nvmet_config_sem);
+
+	list_for_each_entry(host, &nvmet_hosts_list, entry) {
+		if (!strcmp(nvmet_host_name(host), hostnqn)) {
+			kref_get(&host->qos->ref);
+			return host->qos;
+		}
+	}
+	return NULL;
+}
+
+static ssize_t nvmet_host_attr_qos_iops_show(struct config_item *item,
+		char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%llu\n",
+		READ_ONCE(to_host(item)->qos->iops));
+}
+
+static ssize_t nvmet_host_attr_qos_iops_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_qos *qos = to_host(item)->qos;
+	u64 iops;
+
+	if (kstrtou64(page, 0, &iops))
+		return -EINVAL;
+
+	down_write(&nvmet_config_sem);
+	nvmet_qos_set(qos, iops, qos->bps, qos->weight);
+	up_write(&nvmet_config_sem);
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_host_, attr_qos_iops);
+
+static ssize_t nvmet_host_attr_qos_bps_show(struct config_item *item,
+		char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%llu\n",
+		READ_ONCE(to_host(item)->qos->bps));
+}
+
+static ssize_t nvmet_host_attr_qos_bps_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_qos *qos = to_host(item)->qos;
+	u64 bps;
+
+	if (kstrtou64(page, 0, &bps))
+		return -EINVAL;
+
+	down_write(&nvmet_config_sem);
+	nvmet_qos_set(qos, qos->iops, bps, qos->weight);
+	up_write(&nvmet_config_sem);
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_host_, attr_qos_bps);
+
+static ssize_t nvmet_host_attr_qos_weight_show(struct config_item *item,
+		char *page)
+{
+	return snprintf(page, PAGE_SIZE, "%u\n",
+		READ_ONCE(to_host(item)->qos->weight));
+}
+
+static ssize_t nvmet_host_attr_qos_weight_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_qos *qos = to_host(item)->qos;
+	u32 weight;
+
+	if (kstrtou32(page, 0, &weight))
+		return -EINVAL;
+	if (!weight || weight > NVMET_QOS_WEIGHT_MAX) {
+		pr_err("qos weight must be between 1 and %d\n",
+			NVMET_QOS_WEIGHT_MAX);
+		return -EINVAL;
+	}
+
+	down_write(&nvmet_config_sem);
+	nvmet_qos_set(qos, qos->iops, qos->bps, weight);
+	up_write(&nvmet_config_sem);
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_host_, attr_qos_weight);
+
+static struct configfs_attribute *nvmet_host_attrs[] = {
+	&nvmet_host_attr_attr_qos_iops,
+	&nvmet_host_attr_attr_qos_bps,
+	&nvmet_host_attr_attr_qos_weight,
+	NULL,
+};
+
 static void nvmet_host_release(struct config_item *item)
 {
 	struct nvmet_host *host = to_host(item);
 
+	/* live controllers keep the QoS, but no longer limited by it */
+	down_write(&nvmet_config_sem);
+	list_del(&host->entry);
+	nvmet_qos_set(host->qos, 0, 0, NVMET_QOS_WEIGHT_DEFAULT);
+	up_write(&nvmet_config_sem);
+
+	nvmet_qos_put(host->qos);
 	kfree(host);
 }
 
@@ -1267,6 +1471,7 @@ static struct configfs_item_operations nvmet_host_item_ops = {
 
 static const struct config_item_type nvmet_host_type = {
 	.ct_item_ops		= &nvmet_host_item_ops,
+	.ct_attrs		= nvmet_host_attrs,
 	.ct_owner		= THIS_MODULE,
 };
 
@@ -1279,8 +1484,18 @@ static struct config_group *nvmet_hosts_make_group(struct config_group *group,
 	if (!host)
 		return ERR_PTR(-ENOMEM);
 
+	host->qos = nvmet_qos_alloc();
+	if (!host->qos) {
+		kfree(host);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	config_group_init_type_name(&host->group, name, &nvmet_host_type);
 
+	down_write(&nvmet_config_sem);
+	list_add_tail(&host->entry, &nvmet_hosts_list);
+	up_write(&nvmet_config_sem);
+
 	return &host->group;
 }
 
@@ -32,6 +32,7 @@ static DEFINE_IDA(cntlid_ida);
  *  - subsystems list
  *  - per-subsystem allowed hosts list
  *  - allow_any_host subsystem attribute
+ *  - the configfs hosts list, and the QoS settings of each host
  *  - nvmet_genctr
  *  - the nvmet_transports array
  *
@@ -364,6 +365,7 @@ void nvmet_put_namespace(struct nvmet_ns *ns)
 
 static void nvmet_ns_dev_disable(struct nvmet_ns *ns)
 {
+	nvmet_mem_ns_disable(ns);
 	nvmet_bdev_ns_disable(ns);
 	nvmet_file_ns_disable(ns);
 }
@@ -465,7 +467,9 @@ int nvmet_ns_enable(struct nvmet_ns *ns)
 	if (ns->enabled)
 		goto out_unlock;
 
-	ret = nvmet_bdev_ns_enable(ns);
+	ret = nvmet_mem_ns_enable(ns);
+	if (ret == -ENOTBLK)
+		ret = nvmet_bdev_ns_enable(ns);
 	if (ret == -ENOTBLK)
 		ret = nvmet_file_ns_enable(ns);
 	if (ret)
@@ -669,6 +673,7 @@ void nvmet_sq_destroy(struct nvmet_sq *sq)
 	wait_for_completion(&sq->confirm_done);
 	wait_for_completion(&sq->free_done);
 	percpu_ref_exit(&sq->ref);
+	nvmet_file_free_sq_bvecs(sq);
 
 	if (sq->ctrl) {
 		nvmet_ctrl_put(sq->ctrl);
@@ -695,6 +700,8 @@ int nvmet_sq_init(struct nvmet_sq *sq)
 	}
 	init_completion(&sq->free_done);
 	init_completion(&sq->confirm_done);
+	spin_lock_init(&sq->bvec_lock);
+	sq->bvec_free = NULL;
 
 	return 0;
 }
@@ -748,7 +755,9 @@ static u16 nvmet_parse_io_cmd(struct nvmet_req *req)
 	if (unlikely(ret))
 		return ret;
 
-	if (req->ns->file)
+	if (req->ns->mem)
+		return nvmet_mem_parse_io_cmd(req);
+	else if (req->ns->file)
 		return nvmet_file_parse_io_cmd(req);
 	else
 		return nvmet_bdev_parse_io_cmd(req);
@@ -765,6 +774,7 @@ bool nvmet_req_init(struct nvmet_req *req, struct nvmet_cq *cq,
 	req->ops = ops;
 	req->sg = NULL;
 	req->sg_cnt = 0;
+	req->mem_sg = false;
 	req->transfer_len = 0;
 	req->rsp->status = 0;
 	req->rsp->sq_head = 0;
@@ -838,6 +848,9 @@ int nvmet_req_alloc_sgl(struct nvmet_req *req)
 {
 	struct pci_dev *p2p_dev = NULL;
 
+	if (!nvmet_mem_alloc_sgl(req))
+		return 0;
+
 	if (IS_ENABLED(CONFIG_PCI_P2PDMA)) {
 		if (req->sq->ctrl && req->ns)
 			p2p_dev = radix_tree_lookup(&req->sq->ctrl->p2p_ns_map,
@@ -869,6 +882,11 @@ EXPORT_SYMBOL_GPL(nvmet_req_alloc_sgl);
 
 void nvmet_req_free_sgl(struct nvmet_req *req)
 {
+	if (req->mem_sg) {
+		nvmet_mem_free_sgl(req);
+		return;
+	}
+
 	if (req->p2p_dev)
 		pci_p2pmem_free_sgl(req->p2p_dev, req->sg);
 	else
@@ -1162,6 +1180,10 @@ u16 nvmet_alloc_ctrl(const char *subsysnqn, const char *hostnqn,
 	}
 	ctrl->cntlid = ret;
 
+	down_read(&nvmet_config_sem);
+	ctrl->qos = nvmet_host_qos_get(hostnqn);
+	up_read(&nvmet_config_sem);
+
 	ctrl->ops = req->ops;
 
 	/*
@@ -1215,6 +1237,8 @@ static void nvmet_ctrl_free(struct kref *ref)
 
 	ida_simple_remove(&cntlid_ida, ctrl->cntlid);
 
+	if (ctrl->qos)
+		nvmet_qos_put(ctrl->qos);
 	kfree(ctrl->sqs);
 	kfree(ctrl->cqs);
 	kfree(ctrl->changed_ns_list);
@@ -0,0 +1,154 @@
+/*
+ * i10 target transport tracepoints
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM i10_target
+
+#if !defined(_TRACE_I10_TARGET_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_I10_TARGET_H
+
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+
+/*
+ * @idx is the target queue (connection) index and @qid the NVMe queue
+ * id the host sees; with @cid they join the per-command events and
+ * match the host's i10_host events.  See tools/i10_target_lat.bt.
+ */
+
+DECLARE_EVENT_CLASS(i10_target_cmd,
+	TP_PROTO(int idx, int qid, int cid, u8 opcode, u32 len),
+	TP_ARGS(idx, qid, cid, opcode, len),
+	TP_STRUCT__entry(
+		__field(int, idx)
+		__field(int, qid)
+		__field(int, cid)
+		__field(u8, opcode)
+		__field(u32, len)
+	),
+	TP_fast_assign(
+		__entry->idx = idx;
+		__entry->qid = qid;
+		__entry->cid = cid;
+		__entry->opcode = opcode;
+		__entry->len = len;
+	),
+	TP_printk("queue %d: qid=%d, cmdid=%u, opcode=%#x, len=%u",
+		__entry->idx, __entry->qid, __entry->cid, __entry->opcode,
+		__entry->len)
+);
+
+/* A command capsule was parsed */
+DEFINE_EVENT(i10_target_cmd, i10_target_recv_cmd,
+	TP_PROTO(int idx, int qid, int cid, u8 opcode, u32 len),
+	TP_ARGS(idx, qid, cid, opcode, len)
+);
+
+/* The command, with all of its data, went to the backend */
+DEFINE_EVENT(i10_target_cmd, i10_target_exec,
+	TP_PROTO(int idx, int qid, int cid, u8 opcode, u32 len),
+	TP_ARGS(idx, qid, cid, opcode, len)
+);
+
+TRACE_EVENT(i10_target_queue_response,
+	TP_PROTO(int idx, int qid, int cid, u16 status, bool r2t),
+	TP_ARGS(idx, qid, cid, status, r2t),
+	TP_STRUCT__entry(
+		__field(int, idx)
+		__field(int, qid)
+		__field(int, cid)
+		__field(u16, status)
+		__field(bool, r2t)
+	),
+	TP_fast_assign(
+		__entry->idx = idx;
+		__entry->qid = qid;
+		__entry->cid = cid;
+		__entry->status = status;
+		__entry->r2t = r2t;
+	),
+	TP_printk("queue %d: qid=%d, cmdid=%u, status=%#x, r2t=%d",
+		__entry->idx, __entry->qid, __entry->cid, __entry->status,
+		__entry->r2t)
+);
+
+DECLARE_EVENT_CLASS(i10_target_doorbell,
+	TP_PROTO(int idx, const char *lane, int nr_cmds, int delay_us),
+	TP_ARGS(idx, lane, nr_cmds, delay_us),
+	TP_STRUCT__entry(
+		__field(int, idx)
+		__string(lane, lane)
+		__field(int, nr_cmds)
+		__field(int, delay_us)
+	),
+	TP_fast_assign(
+		__entry->idx = idx;
+		__assign_str(lane, lane);
+		__entry->nr_cmds = nr_cmds;
+		__entry->delay_us = delay_us;
+	),
+	TP_printk("queue %d: lane=%s, nr_cmds=%d, delay_us=%d",
+		__entry->idx, __get_str(lane), __entry->nr_cmds,
+		__entry->delay_us)
+);
+
+DEFINE_EVENT(i10_target_doorbell, i10_target_doorbell_armed,
+	TP_PROTO(int idx, const char *lane, int nr_cmds, int delay_us),
+	TP_ARGS(idx, lane, nr_cmds, delay_us)
+);
+
+DEFINE_EVENT(i10_target_doorbell, i10_target_doorbell_fired,
+	TP_PROTO(int idx, const char *lane, int nr_cmds, int delay_us),
+	TP_ARGS(idx, lane, nr_cmds, delay_us)
+);
+
+DEFINE_EVENT(i10_target_doorbell, i10_target_doorbell_cancelled,
+	TP_PROTO(int idx, const char *lane, int nr_cmds, int delay_us),
+	TP_ARGS(idx, lane, nr_cmds, delay_us)
+);
+
+TRACE_EVENT(i10_target_caravan_flush,
+	TP_PROTO(int idx, const char *lane, size_t bytes, int iovs,
+		const char *reason, u64 first_ns),
+	TP_ARGS(idx, lane, bytes, iovs, reason, first_ns),
+	TP_STRUCT__entry(
+		__field(int, idx)
+		__string(lane, lane)
+		__field(size_t, bytes)
+		__field(int, iovs)
+		__string(reason, reason)
+		__field(u64, wait_ns)
+	),
+	TP_fast_assign(
+		__entry->idx = idx;
+		__assign_str(lane, lane);
+		__entry->bytes = bytes;
+		__entry->iovs = iovs;
+		__assign_str(reason, reason);
+		/* only read the clock when the event is enabled */
+		__entry->wait_ns = ktime_get_ns() - first_ns;
+	),
+	TP_printk("queue %d: lane=%s, bytes=%zu, iovs=%d, reason=%s, wait_ns=%llu",
+		__entry->idx, __get_str(lane), __entry->bytes, __entry->iovs,
+		__get_str(reason), __entry->wait_ns)
+);
+
+#endif /* _TRACE_I10_TARGET_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE i10_trace
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
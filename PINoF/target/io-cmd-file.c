@@ -8,10 +8,13 @@
 #include <linux/uio.h>
 #include <linux/falloc.h>
 #include <linux/file.h>
+#include <linux/blkdev.h>
 #include "nvmet.h"
 
 #define NVMET_MAX_MPOOL_BVEC		16
 #define NVMET_MIN_MPOOL_OBJ		16
+/* a page of bio_vecs, 1M of data with 4K pages */
+#define NVMET_SQ_BVEC_CNT		(PAGE_SIZE / sizeof(struct bio_vec))
 
 void nvmet_file_ns_disable(struct nvmet_ns *ns)
 {
@@ -75,6 +78,62 @@ err:
 	return ret;
 }
 
+/*
+ * Commands too big for the inline bvecs but within NVMET_SQ_BVEC_CNT pages
+ * take their bio_vec array from their sq, which keeps the arrays once
+ * allocated until nvmet_sq_destroy().  An sq never holds more of them
+ * than it had such commands in flight at once.
+ */
+static struct bio_vec *nvmet_file_get_bvec(struct nvmet_sq *sq)
+{
+	struct bio_vec *bvec;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sq->bvec_lock, flags);
+	bvec = sq->bvec_free;
+	if (bvec)
+		sq->bvec_free = *(struct bio_vec **)bvec;
+	spin_unlock_irqrestore(&sq->bvec_lock, flags);
+
+	if (!bvec)
+		bvec = kmalloc_array(NVMET_SQ_BVEC_CNT, sizeof(*bvec),
+				GFP_KERNEL);
+	return bvec;
+}
+
+static void nvmet_file_put_bvec(struct nvmet_sq *sq, struct bio_vec *bvec)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sq->bvec_lock, flags);
+	*(struct bio_vec **)bvec = sq->bvec_free;
+	sq->bvec_free = bvec;
+	spin_unlock_irqrestore(&sq->bvec_lock, flags);
+}
+
+void nvmet_file_free_sq_bvecs(struct nvmet_sq *sq)
+{
+	struct bio_vec *bvec;
+
+	while ((bvec = sq->bvec_free)) {
+		sq->bvec_free = *(struct bio_vec **)bvec;
+		kfree(bvec);
+	}
+}
+
+static void nvmet_file_free_bvec(struct nvmet_req *req)
+{
+	if (req->f.bvec == req->inline_bvec)
+		return;
+
+	if (unlikely(req->f.mpool_alloc))
+		mempool_free(req->f.bvec, req->ns->bvec_pool);
+	else if (DIV_ROUND_UP(req->data_len, PAGE_SIZE) <= NVMET_SQ_BVEC_CNT)
+		nvmet_file_put_bvec(req->sq, req->f.bvec);
+	else
+		kfree(req->f.bvec);
+}
+
 static void nvmet_file_init_bvec(struct bio_vec *bv, struct sg_page_iter *iter)
 {
 	bv->bv_page = sg_page_iter_page(iter);
@@ -113,17 +172,54 @@ static void nvmet_file_io_done(struct kiocb *iocb, long ret, long ret2)
 {
 	struct nvmet_req *req = container_of(iocb, struct nvmet_req, f.iocb);
 
-	if (req->f.bvec != req->inline_bvec) {
-		if (likely(req->f.mpool_alloc == false))
-			kfree(req->f.bvec);
-		else
-			mempool_free(req->f.bvec, req->ns->bvec_pool);
-	}
-
+	nvmet_file_free_bvec(req);
 	nvmet_req_complete(req, ret != req->data_len ?
 			NVME_SC_INTERNAL | NVME_SC_DNR : 0);
 }
 
+struct nvmet_file_plug {
+	struct blk_plug_cb	cb;
+	struct llist_head	reqs;
+};
+
+static void nvmet_file_unplug(struct blk_plug_cb *cb, bool from_schedule)
+{
+	struct nvmet_file_plug *plug =
+		container_of(cb, struct nvmet_file_plug, cb);
+	struct llist_node *node = llist_del_all(&plug->reqs);
+	struct nvmet_req *req, *tmp;
+
+	node = llist_reverse_order(node);
+	llist_for_each_entry_safe(req, tmp, node, f.plug_node)
+		nvmet_req_complete(req, req->f.status);
+	kfree(plug);
+}
+
+/*
+ * A buffered read served from the page cache under IOCB_NOWAIT finishes
+ * inside nvmet_req_execute().  If the transport submitted it under a plug,
+ * together with the rest of what it received in one go, its completion
+ * waits for the plug too, so that the whole batch is submitted first and
+ * then completed in order.
+ */
+static void nvmet_file_io_done_nowait(struct nvmet_req *req, long ret)
+{
+	struct blk_plug_cb *cb;
+
+	cb = blk_check_plugged(nvmet_file_unplug, NULL,
+			sizeof(struct nvmet_file_plug));
+	if (!cb) {
+		nvmet_file_io_done(&req->f.iocb, ret, 0);
+		return;
+	}
+
+	nvmet_file_free_bvec(req);
+	req->f.status = ret != req->data_len ?
+			NVME_SC_INTERNAL | NVME_SC_DNR : 0;
+	llist_add(&req->f.plug_node,
+		&container_of(cb, struct nvmet_file_plug, cb)->reqs);
+}
+
 static bool nvmet_file_execute_io(struct nvmet_req *req, int ki_flags)
 {
 	ssize_t nr_bvec = DIV_ROUND_UP(req->data_len, PAGE_SIZE);
@@ -204,7 +300,10 @@ static bool nvmet_file_execute_io(struct nvmet_req *req, int ki_flags)
 	}
 
 complete:
-	nvmet_file_io_done(&req->f.iocb, ret, 0);
+	if (ki_flags & IOCB_NOWAIT)
+		nvmet_file_io_done_nowait(req, ret);
+	else
+		nvmet_file_io_done(&req->f.iocb, ret, 0);
 	return true;
 }
 
@@ -230,11 +329,13 @@ static void nvmet_file_execute_rw(struct nvmet_req *req)
 		return;
 	}
 
-	if (nr_bvec > NVMET_MAX_INLINE_BIOVEC)
+	if (nr_bvec <= NVMET_MAX_INLINE_BIOVEC)
+		req->f.bvec = req->inline_bvec;
+	else if (nr_bvec <= NVMET_SQ_BVEC_CNT)
+		req->f.bvec = nvmet_file_get_bvec(req->sq);
+	else
 		req->f.bvec = kmalloc_array(nr_bvec, sizeof(struct bio_vec),
 				GFP_KERNEL);
-	else
-		req->f.bvec = req->inline_bvec;
 
 	if (unlikely(!req->f.bvec)) {
 		/* fallback under memory pressure */
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * NVMe Over Fabrics Target null and RAM backed namespaces.
+ *
+ * A device_path of "null:<size>" gives a namespace that completes every
+ * command at once and reads back zeroes; "ram:<size>[@<node>]" one whose
+ * data lives in pages preallocated up front, from <node> if given or else
+ * from the node enabling it.  <size> takes the usual K/M/G suffixes.
+ * Both exist to measure a transport without a device underneath it.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/highmem.h>
+#include <linux/mm.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include "nvmet.h"
+
+#define NVMET_MEM_BLKSIZE_SHIFT		12
+
+void nvmet_mem_ns_disable(struct nvmet_ns *ns)
+{
+	unsigned long i;
+
+	if (!ns->mem)
+		return;
+
+	if (ns->mem_pages) {
+		for (i = 0; i < ns->nr_mem_pages; i++)
+			if (ns->mem_pages[i])
+				__free_page(ns->mem_pages[i]);
+		kvfree(ns->mem_pages);
+		ns->mem_pages = NULL;
+	}
+	ns->nr_mem_pages = 0;
+	ns->mem = false;
+}
+
+static int nvmet_mem_alloc_pages(struct nvmet_ns *ns, int node)
+{
+	unsigned long i;
+
+	ns->mem_pages = kvcalloc(ns->nr_mem_pages, sizeof(*ns->mem_pages),
+			GFP_KERNEL);
+	if (!ns->mem_pages)
+		return -ENOMEM;
+
+	for (i = 0; i < ns->nr_mem_pages; i++) {
+		ns->mem_pages[i] = alloc_pages_node(node,
+				GFP_KERNEL | __GFP_ZERO, 0);
+		if (!ns->mem_pages[i])
+			return -ENOMEM;
+		cond_resched();
+	}
+	return 0;
+}
+
+int nvmet_mem_ns_enable(struct nvmet_ns *ns)
+{
+	const char *path = ns->device_path;
+	int node = numa_node_id();
+	bool ram = false;
+	char *end;
+	u64 size;
+	int ret;
+
+	if (!strncmp(path, "ram:", 4))
+		ram = true;
+	else if (strncmp(path, "null:", 5))
+		return -ENOTBLK;
+	path = strchr(path, ':') + 1;
+
+	size = memparse(path, &end);
+	if (ram && *end == '@') {
+		ret = kstrtoint(end + 1, 0, &node);
+		if (ret || node < 0 || node >= nr_node_ids ||
+		    !node_online(node)) {
+			pr_err("invalid node in %s\n", ns->device_path);
+			return -EINVAL;
+		}
+	} else if (*end && *end != '\n') {
+		pr_err("invalid size in %s\n", ns->device_path);
+		return -EINVAL;
+	}
+
+	size = round_down(size, 1 << NVMET_MEM_BLKSIZE_SHIFT);
+	if (!size) {
+		pr_err("%s is smaller than a block\n", ns->device_path);
+		return -EINVAL;
+	}
+
+	ns->mem = true;
+	ns->size = size;
+	ns->blksize_shift = NVMET_MEM_BLKSIZE_SHIFT;
+	if (ram) {
+		ns->nr_mem_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+		ret = nvmet_mem_alloc_pages(ns, node);
+		if (ret) {
+			pr_err("failed to allocate %llu bytes for %s\n",
+				size, ns->device_path);
+			goto err;
+		}
+	}
+	return 0;
+err:
+	nvmet_mem_ns_disable(ns);
+	ns->size = 0;
+	ns->blksize_shift = 0;
+	return ret;
+}
+
+static u16 nvmet_mem_check_range(struct nvmet_req *req, loff_t pos,
+		size_t len)
+{
+	if (pos < 0 || len > req->ns->size || pos > req->ns->size - len)
+		return NVME_SC_LBA_RANGE | NVME_SC_DNR;
+	return 0;
+}
+
+/*
+ * Reads of a null namespace, and page aligned reads of a RAM one, do not
+ * need buffers of their own: req->sg can point at the zero page or at the
+ * namespace's pages, and the read itself then has nothing left to do.
+ * Transports try this before allocating; -EOPNOTSUPP means allocate as
+ * usual.  The data is only read when the transport sends it, so a write
+ * racing with the read may show through.  Each lent page is referenced
+ * until nvmet_mem_free_sgl(), since the namespace may be disabled, and
+ * its pages freed, while the transport still sends from them.
+ */
+int nvmet_mem_alloc_sgl(struct nvmet_req *req)
+{
+	struct nvmet_ns *ns = req->ns;
+	size_t len = req->transfer_len;
+	struct scatterlist *sg;
+	unsigned long idx;
+	loff_t pos;
+	int i, nr;
+
+	if (!ns || !ns->mem || req->cmd->rw.opcode != nvme_cmd_read ||
+	    !len || len != req->data_len)
+		return -EOPNOTSUPP;
+
+	pos = le64_to_cpu(req->cmd->rw.slba) << ns->blksize_shift;
+	if ((ns->mem_pages && offset_in_page(pos)) ||
+	    nvmet_mem_check_range(req, pos, len))
+		return -EOPNOTSUPP;
+
+	nr = DIV_ROUND_UP(len, PAGE_SIZE);
+	sg = kmalloc_array(nr, sizeof(*sg), GFP_KERNEL);
+	if (!sg)
+		return -ENOMEM;
+
+	sg_init_table(sg, nr);
+	idx = pos >> PAGE_SHIFT;
+	for (i = 0; i < nr; i++) {
+		size_t n = min_t(size_t, len, PAGE_SIZE);
+		struct page *page = ns->mem_pages ?
+			ns->mem_pages[idx + i] : ZERO_PAGE(0);
+
+		get_page(page);
+		sg_set_page(&sg[i], page, n, 0);
+		len -= n;
+	}
+
+	req->sg = sg;
+	req->sg_cnt = nr;
+	req->mem_sg = true;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(nvmet_mem_alloc_sgl);
+
+void nvmet_mem_free_sgl(struct nvmet_req *req)
+{
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(req->sg, sg, req->sg_cnt, i)
+		put_page(sg_page(sg));
+	kfree(req->sg);
+	req->sg = NULL;
+	req->sg_cnt = 0;
+	req->mem_sg = false;
+}
+EXPORT_SYMBOL_GPL(nvmet_mem_free_sgl);
+
+static void nvmet_mem_copy(struct nvmet_req *req, loff_t pos, bool write)
+{
+	struct page **pages = req->ns->mem_pages;
+	struct sg_mapping_iter miter;
+
+	sg_miter_start(&miter, req->sg, req->sg_cnt, SG_MITER_ATOMIC |
+			(write ? SG_MITER_FROM_SG : SG_MITER_TO_SG));
+	while (sg_miter_next(&miter)) {
+		size_t done = 0;
+
+		while (done < miter.length) {
+			size_t off = offset_in_page(pos);
+			size_t n = min_t(size_t, miter.length - done,
+					PAGE_SIZE - off);
+			void *vaddr = kmap_atomic(pages[pos >> PAGE_SHIFT]);
+
+			if (write)
+				memcpy(vaddr + off, miter.addr + done, n);
+			else
+				memcpy(miter.addr + done, vaddr + off, n);
+			kunmap_atomic(vaddr);
+			done += n;
+			pos += n;
+		}
+	}
+	sg_miter_stop(&miter);
+}
+
+static void nvmet_mem_zero(struct nvmet_ns *ns, loff_t pos, size_t len)
+{
+	while (len) {
+		size_t off = offset_in_page(pos);
+		size_t n = min_t(size_t, len, PAGE_SIZE - off);
+		void *vaddr = kmap_atomic(ns->mem_pages[pos >> PAGE_SHIFT]);
+
+		memset(vaddr + off, 0, n);
+		kunmap_atomic(vaddr);
+		len -= n;
+		pos += n;
+	}
+}
+
+static void nvmet_mem_execute_rw(struct nvmet_req *req)
+{
+	loff_t pos = le64_to_cpu(req->cmd->rw.slba) << req->ns->blksize_shift;
+	u16 status;
+
+	status = nvmet_mem_check_range(req, pos, req->data_len);
+	if (status || req->mem_sg || !req->sg_cnt)
+		goto out;
+
+	if (req->ns->mem_pages)
+		nvmet_mem_copy(req, pos,
+			req->cmd->rw.opcode == nvme_cmd_write);
+	else if (req->cmd->rw.opcode == nvme_cmd_read)
+		sg_zero_buffer(req->sg, req->sg_cnt, req->data_len, 0);
+out:
+	nvmet_req_complete(req, status);
+}
+
+static void nvmet_mem_execute_write_zeroes(struct nvmet_req *req)
+{
+	struct nvme_write_zeroes_cmd *wz = &req->cmd->write_zeroes;
+	loff_t pos = le64_to_cpu(wz->slba) << req->ns->blksize_shift;
+	size_t len = (((size_t)le16_to_cpu(wz->length) + 1) <<
+			req->ns->blksize_shift);
+	u16 status;
+
+	status = nvmet_mem_check_range(req, pos, len);
+	if (!status && req->ns->mem_pages)
+		nvmet_mem_zero(req->ns, pos, len);
+	nvmet_req_complete(req, status);
+}
+
+/* Nothing is volatile, and deallocated blocks may keep their data */
+static void nvmet_mem_execute_noop(struct nvmet_req *req)
+{
+	nvmet_req_complete(req, 0);
+}
+
+u16 nvmet_mem_flush(struct nvmet_req *req)
+{
+	return 0;
+}
+
+u16 nvmet_mem_parse_io_cmd(struct nvmet_req *req)
+{
+	struct nvme_command *cmd = req->cmd;
+
+	switch (cmd->common.opcode) {
+	case nvme_cmd_read:
+	case nvme_cmd_write:
+		req->execute = nvmet_mem_execute_rw;
+		req->data_len = nvmet_rw_len(req);
+		return 0;
+	case nvme_cmd_flush:
+		req->execute = nvmet_mem_execute_noop;
+		req->data_len = 0;
+		return 0;
+	case nvme_cmd_dsm:
+		req->execute = nvmet_mem_execute_noop;
+		req->data_len = (le32_to_cpu(cmd->dsm.nr) + 1) *
+			sizeof(struct nvme_dsm_range);
+		return 0;
+	case nvme_cmd_write_zeroes:
+		req->execute = nvmet_mem_execute_write_zeroes;
+		req->data_len = 0;
+		return 0;
+	default:
+		pr_err("unhandled cmd for mem ns %d on qid %d\n",
+				cmd->common.opcode, req->sq->qid);
+		return NVME_SC_INVALID_OPCODE | NVME_SC_DNR;
+	}
+}
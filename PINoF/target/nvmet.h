@@ -20,6 +20,7 @@
 #include <linux/kref.h>
 #include <linux/percpu-refcount.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/mutex.h>
 #include <linux/uuid.h>
 #include <linux/nvme.h>
@@ -27,6 +28,8 @@
 #include <linux/rcupdate.h>
 #include <linux/blkdev.h>
 #include <linux/radix-tree.h>
+#include <linux/jump_label.h>
+#include <linux/spinlock.h>
 
 #define NVMET_ASYNC_EVENTS		4
 #define NVMET_ERROR_LOG_SLOTS		128
@@ -83,6 +86,11 @@ struct nvmet_ns {
 
 	int			use_p2pmem;
 	struct pci_dev		*p2p_dev;
+
+	/* null and RAM namespaces, see io-cmd-mem.c */
+	bool			mem;
+	struct page		**mem_pages;	/* NULL for null */
+	unsigned long		nr_mem_pages;
 };
 
 static inline struct nvmet_ns *to_nvmet_ns(struct config_item *item)
@@ -109,6 +117,10 @@ struct nvmet_sq {
 	bool			sqhd_disabled;
 	struct completion	free_done;
 	struct completion	confirm_done;
+
+	/* free bio_vec arrays of the file backend, see nvmet_file_get_bvec() */
+	spinlock_t		bvec_lock;
+	struct bio_vec		*bvec_free;
 };
 
 struct nvmet_ana_group {
@@ -147,6 +159,9 @@ struct nvmet_port {
 	void				*priv;
 	bool				enabled;
 	int				inline_data_size;
+	bool				zero_copy;
+	struct cpumask			io_cpus;
+	bool				busy_poll;
 };
 
 static inline struct nvmet_port *to_nvmet_port(struct config_item *item)
@@ -200,6 +215,8 @@ struct nvmet_ctrl {
 	char			subsysnqn[NVMF_NQN_FIELD_LEN];
 	char			hostnqn[NVMF_NQN_FIELD_LEN];
 
+	struct nvmet_qos	*qos;	/* NULL: host not in configfs */
+
 	struct device		*p2p_client;
 	struct radix_tree_root	p2p_ns_map;
 };
@@ -243,8 +260,41 @@ static inline struct nvmet_subsys *namespaces_to_subsys(
 			namespaces_group);
 }
 
+/*
+ * Per-host QoS, set through the host's attr_qos_* in configfs and shared
+ * by all of the host's controllers.  iops and bps are token buckets, kept
+ * as the time at which each would next be empty (0 is no limit); weight
+ * is the host's share of a target CPU against the other hosts' queues
+ * there, relative to NVMET_QOS_WEIGHT_DEFAULT.  Transports only look at
+ * any of it while nvmet_qos_key is on, that is while some host has a
+ * setting other than the defaults.
+ */
+#define NVMET_QOS_WEIGHT_DEFAULT	100
+#define NVMET_QOS_WEIGHT_MAX		1000
+#define NVMET_QOS_BURST_NS		(10 * NSEC_PER_MSEC)
+
+struct nvmet_qos {
+	struct kref		ref;
+	spinlock_t		lock;
+	u64			iops;
+	u64			bps;
+	u32			weight;
+	bool			enabled;	/* nvmet_qos_key held */
+	u64			io_tat;
+	u64			byte_tat;
+};
+
+DECLARE_STATIC_KEY_FALSE(nvmet_qos_key);
+
+static inline bool nvmet_qos_limited(struct nvmet_qos *qos)
+{
+	return READ_ONCE(qos->iops) || READ_ONCE(qos->bps);
+}
+
 struct nvmet_host {
 	struct config_group	group;
+	struct list_head	entry;
+	struct nvmet_qos	*qos;
 };
 
 static inline struct nvmet_host *to_host(struct config_item *item)
@@ -302,6 +352,8 @@ struct nvmet_req {
 			struct kiocb            iocb;
 			struct bio_vec          *bvec;
 			struct work_struct      work;
+			struct llist_node	plug_node;
+			u16			status;
 		} f;
 	};
 	int			sg_cnt;
@@ -317,6 +369,7 @@ struct nvmet_req {
 
 	struct pci_dev		*p2p_dev;
 	struct device		*p2p_client;
+	bool			mem_sg;	/* sg lent by nvmet_mem_alloc_sgl() */
 };
 
 extern struct workqueue_struct *buffered_io_wq;
@@ -371,6 +424,7 @@ void nvmet_execute_async_event(struct nvmet_req *req);
 u16 nvmet_parse_connect_cmd(struct nvmet_req *req);
 u16 nvmet_bdev_parse_io_cmd(struct nvmet_req *req);
 u16 nvmet_file_parse_io_cmd(struct nvmet_req *req);
+u16 nvmet_mem_parse_io_cmd(struct nvmet_req *req);
 u16 nvmet_parse_admin_cmd(struct nvmet_req *req);
 u16 nvmet_parse_discovery_cmd(struct nvmet_req *req);
 u16 nvmet_parse_fabrics_cmd(struct nvmet_req *req);
@@ -382,6 +436,8 @@ void nvmet_req_execute(struct nvmet_req *req);
 void nvmet_req_complete(struct nvmet_req *req, u16 status);
 int nvmet_req_alloc_sgl(struct nvmet_req *req);
 void nvmet_req_free_sgl(struct nvmet_req *req);
+int nvmet_mem_alloc_sgl(struct nvmet_req *req);
+void nvmet_mem_free_sgl(struct nvmet_req *req);
 
 void nvmet_execute_keep_alive(struct nvmet_req *req);
 
@@ -443,6 +499,12 @@ void nvmet_subsys_disc_changed(struct nvmet_subsys *subsys,
 void nvmet_add_async_event(struct nvmet_ctrl *ctrl, u8 event_type,
 		u8 event_info, u8 log_page);
 
+struct nvmet_qos *nvmet_qos_alloc(void);
+void nvmet_qos_put(struct nvmet_qos *qos);
+void nvmet_qos_set(struct nvmet_qos *qos, u64 iops, u64 bps, u32 weight);
+struct nvmet_qos *nvmet_host_qos_get(const char *hostnqn);
+bool nvmet_qos_admit(struct nvmet_qos *qos, u32 bytes, u64 *wait_ns);
+
 #define NVMET_QUEUE_SIZE	1024
 #define NVMET_NR_QUEUES		128
 #define NVMET_MAX_CMD		NVMET_QUEUE_SIZE
@@ -482,10 +544,14 @@ bool nvmet_host_allowed(struct nvmet_subsys *subsys, const char *hostnqn);
 
 int nvmet_bdev_ns_enable(struct nvmet_ns *ns);
 int nvmet_file_ns_enable(struct nvmet_ns *ns);
+int nvmet_mem_ns_enable(struct nvmet_ns *ns);
 void nvmet_bdev_ns_disable(struct nvmet_ns *ns);
 void nvmet_file_ns_disable(struct nvmet_ns *ns);
+void nvmet_mem_ns_disable(struct nvmet_ns *ns);
 u16 nvmet_bdev_flush(struct nvmet_req *req);
 u16 nvmet_file_flush(struct nvmet_req *req);
+void nvmet_file_free_sq_bvecs(struct nvmet_sq *sq);
+u16 nvmet_mem_flush(struct nvmet_req *req);
 void nvmet_ns_changed(struct nvmet_subsys *subsys, u32 nsid);
 
 static inline u32 nvmet_rw_len(struct nvmet_req *req)
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * NVMe Over Fabrics Target per-host QoS.
+ *
+ * The limits are token buckets in their virtual clock form: each keeps the
+ * time at which it would be empty, a command moves that time forward by
+ * its cost (1s / iops, or its bytes at bps), and a command is admitted as
+ * long as the bucket is not more than NVMET_QOS_BURST_NS in debt.  The
+ * transport decides what to do with a command that is not; it is told how
+ * long to wait for one that would be.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include "nvmet.h"
+
+DEFINE_STATIC_KEY_FALSE(nvmet_qos_key);
+EXPORT_SYMBOL_GPL(nvmet_qos_key);
+
+struct nvmet_qos *nvmet_qos_alloc(void)
+{
+	struct nvmet_qos *qos;
+
+	qos = kzalloc(sizeof(*qos), GFP_KERNEL);
+	if (!qos)
+		return NULL;
+
+	kref_init(&qos->ref);
+	spin_lock_init(&qos->lock);
+	qos->weight = NVMET_QOS_WEIGHT_DEFAULT;
+	return qos;
+}
+
+static void nvmet_qos_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct nvmet_qos, ref));
+}
+
+void nvmet_qos_put(struct nvmet_qos *qos)
+{
+	kref_put(&qos->ref, nvmet_qos_free);
+}
+
+/*
+ * Callers serialize on nvmet_config_sem.  Changing a limit starts its
+ * bucket over, full.
+ */
+void nvmet_qos_set(struct nvmet_qos *qos, u64 iops, u64 bps, u32 weight)
+{
+	bool enabled = iops || bps || weight != NVMET_QOS_WEIGHT_DEFAULT;
+
+	lockdep_assert_held(&nvmet_config_sem);
+
+	spin_lock(&qos->lock);
+	if (qos->iops != iops)
+		qos->io_tat = 0;
+	if (qos->bps != bps)
+		qos->byte_tat = 0;
+	WRITE_ONCE(qos->iops, iops);
+	WRITE_ONCE(qos->bps, bps);
+	WRITE_ONCE(qos->weight, weight);
+	spin_unlock(&qos->lock);
+
+	if (enabled == qos->enabled)
+		return;
+	qos->enabled = enabled;
+	if (enabled)
+		static_branch_inc(&nvmet_qos_key);
+	else
+		static_branch_dec(&nvmet_qos_key);
+}
+
+/*
+ * Charge one command of @bytes to @qos.  Returns false, with the time
+ * until it would be admitted in @wait_ns, if a bucket is too deep in debt;
+ * nothing is charged then.
+ */
+bool nvmet_qos_admit(struct nvmet_qos *qos, u32 bytes, u64 *wait_ns)
+{
+	u64 now, io_tat, byte_tat, wait = 0;
+
+	if (!nvmet_qos_limited(qos))
+		return true;
+
+	now = ktime_get_ns();
+	spin_lock(&qos->lock);
+	io_tat = max(qos->io_tat, now);
+	byte_tat = max(qos->byte_tat, now);
+	if (qos->iops && io_tat - now > NVMET_QOS_BURST_NS)
+		wait = io_tat - now - NVMET_QOS_BURST_NS;
+	if (qos->bps && byte_tat - now > NVMET_QOS_BURST_NS)
+		wait = max(wait, byte_tat - now - NVMET_QOS_BURST_NS);
+
+	if (!wait) {
+		if (qos->iops)
+			qos->io_tat = io_tat +
+				div64_u64(NSEC_PER_SEC, qos->iops);
+		if (qos->bps)
+			qos->byte_tat = byte_tat +
+				div64_u64((u64)bytes * NSEC_PER_SEC, qos->bps);
+	}
+	spin_unlock(&qos->lock);
+
+	*wait_ns = wait;
+	return !wait;
+}
+EXPORT_SYMBOL_GPL(nvmet_qos_admit);